@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Wall clock with a resolution of one second
+ *
+ * Reading the clock is a single relaxed atomic load, which keeps expiry
+ * checks on the authorization hot path cheap. The engine advances the
+ * clock once per second.
+ */
+// ----------------------------------------------------------------------
+
+class CoarseClock
+{
+ public:
+  // Epoch seconds as of the latest update
+  static std::int64_t now() { return itsNow.load(std::memory_order_relaxed); }
+
+  static void update()
+  {
+    itsNow.store(static_cast<std::int64_t>(std::time(nullptr)), std::memory_order_relaxed);
+  }
+
+ private:
+  static inline std::atomic<std::int64_t> itsNow{static_cast<std::int64_t>(std::time(nullptr))};
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
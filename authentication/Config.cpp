@@ -14,17 +14,115 @@ Config::Config(const std::string& configFile) : ConfigBase(configFile)
 {
   try
   {
-    dBHost = get_mandatory_config_param<std::string>("database.host");
-    port = get_mandatory_config_param<unsigned int>("database.port");
-    database = get_mandatory_config_param<std::string>("database.database");
-    schema = get_mandatory_config_param<std::string>("database.schema");
-    user = get_mandatory_config_param<std::string>("database.username");
-    password = get_mandatory_config_param<std::string>("database.password");
-    authTable = get_mandatory_config_param<std::string>("database.auth_table");
-    tokenTable = get_mandatory_config_param<std::string>("database.token_table");
-    updateIntervalSeconds = get_mandatory_config_param<int>("database.update_interval_seconds");
+    updateIntervalSeconds = get_optional_config_param<int>("update_interval_seconds", 5);
+
+    // A list of sources, or a single source given by the source and database sections
+    auto* list = find_setting(get_root(), "sources", false);
+    if (list)
+    {
+      assert_is_list(*list);
+      for (int i = 0; i < list->getLength(); i++)
+      {
+        auto source = readSource((*list)[i], "");
+        if (source.name.empty())
+          source.name = "source" + std::to_string(i + 1);
+        sources.push_back(std::move(source));
+      }
+      if (sources.empty())
+        throw Fmi::Exception(BCP, "The list of sources is empty");
+    }
+    else
+    {
+      sources.push_back(readSource(get_root(), "source."));
+      if (sources.back().type == "postgresql")
+        updateIntervalSeconds = get_mandatory_config_param<int>("database.update_interval_seconds");
+      else
+        updateIntervalSeconds =
+            get_optional_config_param<int>("source.update_interval_seconds", updateIntervalSeconds);
+    }
 
     defaultAccessAllow = get_mandatory_config_param<bool>("default_access_is_allow");
+
+    indexOptions.patternValues = get_optional_config_param<bool>(
+        "pattern_values", get_optional_config_param<bool>("database.pattern_values", false));
+    indexOptions.apikeyFilterRate = get_optional_config_param<double>(
+        "apikey_filter.false_positive_rate", DEFAULT_APIKEY_FILTER_RATE);
+    if (indexOptions.apikeyFilterRate < 0 || indexOptions.apikeyFilterRate >= 1)
+      throw Fmi::Exception(BCP, "apikey_filter.false_positive_rate must be in range [0,1)");
+
+    decisionCache = get_optional_config_param<bool>("decision_cache.enabled", false);
+    decisionCacheEntries = get_optional_config_param<int>("decision_cache.entries", 16384);
+
+    metrics = get_optional_config_param<bool>("metrics.enabled", false);
+
+    snapshotFile = get_optional_config_param<std::string>("snapshot.file", "");
+    snapshotMaxAgeSeconds = get_optional_config_param<int>("snapshot.max_age_seconds", 86400);
+    snapshotMapped = get_optional_config_param<bool>("snapshot.mmap", false);
+    snapshotFollower = get_optional_config_param<bool>("snapshot.follower", false);
+
+    if ((snapshotMapped || snapshotFollower) && snapshotFile.empty())
+      throw Fmi::Exception(BCP, "snapshot.file is required by snapshot.mmap and snapshot.follower");
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+SourceConfig Config::readSource(libconfig::Setting& setting, const std::string& sourcePath) const
+{
+  try
+  {
+    SourceConfig source;
+    source.name = get_optional_config_param<std::string>(setting, sourcePath + "name", "");
+    source.type =
+        get_optional_config_param<std::string>(setting, sourcePath + "type", "postgresql");
+    source.prefix = get_optional_config_param<std::string>(setting, sourcePath + "prefix", "");
+    source.timeoutSeconds =
+        get_optional_config_param<int>(setting, sourcePath + "timeout_seconds", 60);
+    source.tokenFile =
+        get_optional_config_param<std::string>(setting, sourcePath + "token_file", "");
+    source.grantFile =
+        get_optional_config_param<std::string>(setting, sourcePath + "grant_file", "");
+    source.quotaFile =
+        get_optional_config_param<std::string>(setting, sourcePath + "quota_file", "");
+
+    // The database settings are needed only when the data is read from the database
+    if (source.type == "postgresql")
+    {
+      source.dBHost = get_mandatory_config_param<std::string>(setting, "database.host");
+      source.port = get_mandatory_config_param<unsigned int>(setting, "database.port");
+      source.database = get_mandatory_config_param<std::string>(setting, "database.database");
+      source.schema = get_mandatory_config_param<std::string>(setting, "database.schema");
+      source.user = get_mandatory_config_param<std::string>(setting, "database.username");
+      source.password = get_mandatory_config_param<std::string>(setting, "database.password");
+      source.authTable = get_mandatory_config_param<std::string>(setting, "database.auth_table");
+      source.tokenTable = get_mandatory_config_param<std::string>(setting, "database.token_table");
+      source.changelogTable =
+          get_optional_config_param<std::string>(setting, "database.changelog_table", "");
+      source.quotaTable =
+          get_optional_config_param<std::string>(setting, "database.quota_table", "");
+      source.validUntilColumn =
+          get_optional_config_param<std::string>(setting, "database.valid_until_column", "");
+      source.fetchSize = get_optional_config_param<int>(setting, "database.fetch_size", 10000);
+      source.joinedLoad = get_optional_config_param<bool>(setting, "database.joined_load", false);
+      source.changeDetection =
+          get_optional_config_param<bool>(setting, "database.change_detection", true);
+      source.versionQuery =
+          get_optional_config_param<std::string>(setting, "database.version_query", "");
+    }
+    else
+    {
+      source.port = 0;
+      source.fetchSize = 0;
+      source.joinedLoad = false;
+      source.changeDetection = true;
+    }
+
+    if (source.type == "file" && (source.tokenFile.empty() || source.grantFile.empty()))
+      throw Fmi::Exception(BCP, "token_file and grant_file are required by files");
+
+    return source;
   }
   catch (...)
   {
@@ -1,8 +1,10 @@
 #pragma once
 
+#include "ServiceIndex.h"
 #include <spine/ConfigBase.h>
 
 #include <string>
+#include <vector>
 
 namespace SmartMet
 {
@@ -10,12 +12,30 @@ namespace Engine
 {
 namespace Authentication
 {
-class Config : public SmartMet::Spine::ConfigBase
+// ----------------------------------------------------------------------
+/*!
+ * \brief Settings of a single source of authorization data
+ */
+// ----------------------------------------------------------------------
+
+struct SourceConfig
 {
- public:
-  ~Config() override;
+  // Name used in log messages
+  std::string name;
 
-  explicit Config(const std::string& configFile);
+  // Type of the source: "postgresql", "file" or "memory"
+  std::string type;
+
+  // Token, authorization and optional quota files of the file source
+  std::string tokenFile;
+  std::string grantFile;
+  std::string quotaFile;
+
+  // Prepended to the service names of the source
+  std::string prefix;
+
+  // Seconds an update round waits for the source before using its previous data
+  int timeoutSeconds;
 
   std::string dBHost;
 
@@ -33,10 +53,69 @@ class Config : public SmartMet::Spine::ConfigBase
 
   std::string tokenTable;
 
+  // Optional changelog table for incremental updates
+  std::string changelogTable;
+
+  // Optional table of request quotas with columns apikey, service, rate and burst
+  std::string quotaTable;
+
+  // Optional timestamp column of the authorization and changelog tables after which a grant
+  // is no longer valid
+  std::string validUntilColumn;
+
+  // Number of rows fetched at a time while loading the tables
+  int fetchSize;
+
+  // Load both tables with a single joined query sorted by service, apikey and token
+  bool joinedLoad;
+
+  // Probe the tables for changes before reloading them
+  bool changeDetection;
+
+  // Optional custom probe, for example a query on a version row
+  std::string versionQuery;
+};
+
+class Config : public SmartMet::Spine::ConfigBase
+{
+ public:
+  ~Config() override;
+
+  explicit Config(const std::string& configFile);
+
+  // Sources of the data in order of precedence. A service defined by several sources is
+  // taken from the first one.
+  std::vector<SourceConfig> sources;
+
   int updateIntervalSeconds;
 
   // Unknown apikey access behaviour
   bool defaultAccessAllow;
+
+  // Options for building the service indexes: the false positive rate of the apikey filters
+  // and whether range and prefix token values are enabled
+  IndexOptions indexOptions;
+
+  // Per-thread cache of recent decisions, and its number of entries per thread
+  bool decisionCache;
+  int decisionCacheEntries;
+
+  // Count the outcomes and time the latencies of authorization calls
+  bool metrics;
+
+  // Optional warm start snapshot file, and the maximum age of the file for it to be used
+  std::string snapshotFile;
+  int snapshotMaxAgeSeconds;
+
+  // Serve queries directly from the memory mapped snapshot file
+  bool snapshotMapped;
+
+  // Do not read the database, follow the snapshot file written by another process
+  bool snapshotFollower;
+
+ private:
+  // Settings of a source given relative to the setting, the type and files under sourcePath
+  SourceConfig readSource(libconfig::Setting& setting, const std::string& sourcePath) const;
 };
 
 }  // namespace Authentication
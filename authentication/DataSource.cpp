@@ -0,0 +1,185 @@
+#include "DataSource.h"
+#include "CoarseClock.h"
+#include "Config.h"
+#include "FileSource.h"
+#include "MemorySource.h"
+#include "MergedSource.h"
+#include "PostgresSource.h"
+#include <chrono>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+}  // namespace
+
+ServiceIndex::Builder& IndexSink::builder(const std::string& service)
+{
+  if (itsLatest && itsLatestService == service)
+    return *itsLatest;
+
+  auto& builder = itsBuilders[service];
+  if (!builder)
+    builder = std::make_unique<ServiceIndex::Builder>(itsPrefix + service, itsOptions);
+  itsLatest = builder.get();
+  itsLatestService = service;
+  return *builder;
+}
+
+void IndexSink::tokenValue(const std::string& service,
+                           const std::string& token,
+                           const std::string& value)
+{
+  try
+  {
+    itsRows++;
+    builder(service).addTokenValue(token, value);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void IndexSink::grant(const std::string& apikey,
+                      const std::string& service,
+                      const std::string& token,
+                      std::int64_t validUntil)
+{
+  try
+  {
+    itsRows++;
+    if (validUntil <= CoarseClock::now())
+      return;
+    builder(service).addGrant(apikey, token, validUntil);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void IndexSink::finish(const std::string& service)
+{
+  try
+  {
+    auto it = itsBuilders.find(service);
+    if (it == itsBuilders.end())
+      return;
+
+    const auto start = std::chrono::steady_clock::now();
+    itsServices[itsPrefix + service] = it->second->build();
+    if (itsLatest == it->second.get())
+      itsLatest = nullptr;
+    itsBuilders.erase(it);
+    itsBuildSeconds += secondsSince(start);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void IndexSink::service(std::shared_ptr<const ServiceIndex> index)
+{
+  try
+  {
+    const std::string name(index->name());
+    itsServices[name] = std::move(index);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::unique_ptr<const Snapshot> IndexSink::build()
+{
+  try
+  {
+    while (!itsBuilders.empty())
+      finish(itsBuilders.begin()->first);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::shared_ptr<const ServiceIndex>> services;
+    for (auto& service : itsServices)
+      services.push_back(std::move(service.second));
+    itsServices.clear();
+    auto snapshot = std::make_unique<const Snapshot>(std::move(services));
+    itsBuildSeconds += secondsSince(start);
+    return snapshot;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void applyChange(SnapshotBuilder& builder, const RowChange& change)
+{
+  try
+  {
+    if (!change.grant)
+    {
+      if (change.insert)
+        builder.addTokenValue(change.service, change.token, change.value);
+      else
+        builder.removeTokenValue(change.service, change.token, change.value);
+    }
+    else if (change.insert)
+      builder.addGrant(change.apikey, change.service, change.token, change.validUntil);
+    else
+      builder.removeGrant(change.apikey, change.service, change.token);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::unique_ptr<DataSource> DataSource::create(const Config& config)
+{
+  try
+  {
+    // A single source is used directly, which keeps its changes incremental
+    if (config.sources.size() == 1 && config.sources.front().prefix.empty())
+      return create(config.sources.front());
+    return std::make_unique<MergedSource>(config.sources, config.indexOptions);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::unique_ptr<DataSource> DataSource::create(const SourceConfig& config)
+{
+  try
+  {
+    if (config.type == "postgresql")
+      return std::make_unique<PostgresSource>(config);
+    if (config.type == "file")
+      return std::make_unique<FileSource>(config.tokenFile, config.grantFile, config.quotaFile);
+    if (config.type == "memory")
+      return std::make_unique<MemorySource>();
+    throw Fmi::Exception(BCP, "Unknown data source")
+        .addParameter("Source", config.name)
+        .addParameter("Type", config.type);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
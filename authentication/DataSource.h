@@ -0,0 +1,172 @@
+#pragma once
+
+#include "Engine.h"
+#include "QuotaTable.h"
+#include "Snapshot.h"
+#include <macgyver/Exception.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+class Config;
+struct SourceConfig;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Receives the rows of the token and authorization tables
+ */
+// ----------------------------------------------------------------------
+
+class RowSink
+{
+ public:
+  virtual ~RowSink() = default;
+
+  virtual void tokenValue(const std::string& service,
+                          const std::string& token,
+                          const std::string& value) = 0;
+
+  virtual void grant(const std::string& apikey,
+                     const std::string& service,
+                     const std::string& token,
+                     std::int64_t validUntil) = 0;
+
+  // All the rows of the service have been passed. Optional, merely lets the sink release the
+  // rows early.
+  virtual void finish(const std::string& service) = 0;
+
+  // A service already built by the source, which replaces any rows of the service
+  virtual void service(std::shared_ptr<const ServiceIndex> index) = 0;
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Builds a snapshot from rows in any order
+ *
+ * Grants which have already expired are dropped. Row counts and the time
+ * spent building the indexes are kept for the update statistics. The
+ * optional prefix is prepended to the service names of the rows.
+ */
+// ----------------------------------------------------------------------
+
+class IndexSink : public RowSink
+{
+ public:
+  explicit IndexSink(const IndexOptions& options, std::string prefix = "")
+      : itsOptions(options), itsPrefix(std::move(prefix))
+  {
+  }
+
+  void tokenValue(const std::string& service,
+                  const std::string& token,
+                  const std::string& value) override;
+
+  void grant(const std::string& apikey,
+             const std::string& service,
+             const std::string& token,
+             std::int64_t validUntil) override;
+
+  void finish(const std::string& service) override;
+
+  void service(std::shared_ptr<const ServiceIndex> index) override;
+
+  std::unique_ptr<const Snapshot> build();
+
+  std::size_t rows() const { return itsRows; }
+  double buildSeconds() const { return itsBuildSeconds; }
+
+ private:
+  ServiceIndex::Builder& builder(const std::string& service);
+
+  IndexOptions itsOptions;
+  std::string itsPrefix;
+  std::map<std::string, std::unique_ptr<ServiceIndex::Builder>> itsBuilders;  // without prefix
+  std::map<std::string, std::shared_ptr<const ServiceIndex>> itsServices;
+  ServiceIndex::Builder* itsLatest = nullptr;  // rows usually arrive grouped by service
+  std::string itsLatestService;
+  std::size_t itsRows = 0;
+  double itsBuildSeconds = 0;
+};
+
+// A row inserted into or deleted from either table since the previous update
+struct RowChange
+{
+  bool insert = true;
+  bool grant = false;  // row of the authorization table, otherwise of the token table
+  std::string apikey;
+  std::string service;
+  std::string token;
+  std::string value;
+  std::int64_t validUntil = NO_EXPIRY;
+};
+
+// Apply a change to the snapshot being built
+void applyChange(SnapshotBuilder& builder, const RowChange& change);
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Source of the authorization data
+ *
+ * The engine reads a source once per update round. All reads between
+ * begin() and end() see the same data, and end(true) tells the source
+ * that the data read has been taken into use, after which changes() may
+ * continue from it.
+ */
+// ----------------------------------------------------------------------
+
+class DataSource
+{
+ public:
+  virtual ~DataSource() = default;
+
+  // Selected by the configuration, several sources are merged into one
+  static std::unique_ptr<DataSource> create(const Config& config);
+
+  static std::unique_ptr<DataSource> create(const SourceConfig& config);
+
+  virtual void begin() {}
+  virtual void end(bool success) { (void)success; }
+
+  // Fingerprint of the current data, empty if unknown. Unchanged data is not reloaded.
+  virtual std::string version() = 0;
+
+  // Pass all the rows to the sink
+  virtual void load(RowSink& sink) = 0;
+
+  // Changes since the data last taken into use, false if everything must be loaded instead
+  virtual bool changes(std::vector<RowChange>& changes)
+  {
+    (void)changes;
+    return false;
+  }
+
+  // Request quotas, false if the source has none
+  virtual bool quotas(QuotaData& quotas)
+  {
+    (void)quotas;
+    return false;
+  }
+
+  // Replace the data of an in-memory source. May be called by any thread while another one
+  // reads the source, hence sources accepting data must synchronize it with their reads.
+  virtual void setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants)
+  {
+    (void)tokens;
+    (void)grants;
+    throw Fmi::Exception(BCP, "The data source does not accept data from the process");
+  }
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,227 @@
+#include "DecisionCache.h"
+#include <macgyver/Exception.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+// Table and counters of a single thread. The counters are written only by the owning thread,
+// they are atomic only so that statistics() may read them.
+struct ThreadTable
+{
+  std::vector<DecisionCache::Entry> entries;
+  std::atomic<std::uint64_t> hits{0};
+  std::atomic<std::uint64_t> misses{0};
+};
+
+// Tables of all live threads, plus the counts of threads which have exited
+struct Registry
+{
+  std::mutex mutex;
+  std::set<const ThreadTable*> tables;
+  std::uint64_t retiredHits = 0;
+  std::uint64_t retiredMisses = 0;
+};
+
+// Never destroyed, threads may exit after static destructors have been run
+Registry& registry()
+{
+  static auto* instance = new Registry;
+  return *instance;
+}
+
+class ThreadTableHolder
+{
+ public:
+  ThreadTableHolder()
+  {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.tables.insert(&table);
+  }
+
+  ~ThreadTableHolder()
+  {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.retiredHits += table.hits.load();
+    reg.retiredMisses += table.misses.load();
+    reg.tables.erase(&table);
+  }
+
+  ThreadTableHolder(const ThreadTableHolder& other) = delete;
+  ThreadTableHolder& operator=(const ThreadTableHolder& other) = delete;
+  ThreadTableHolder(ThreadTableHolder&& other) = delete;
+  ThreadTableHolder& operator=(ThreadTableHolder&& other) = delete;
+
+  ThreadTable table;
+};
+
+ThreadTable& threadTable()
+{
+  thread_local ThreadTableHolder holder;
+  return holder.table;
+}
+
+// Random per process, so that colliding keys cannot be computed in advance
+struct Seeds
+{
+  Seeds()
+  {
+    std::uint64_t entropy =
+        static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    try
+    {
+      std::random_device device;
+      entropy ^= (static_cast<std::uint64_t>(device()) << 32) | device();
+    }
+    catch (...)
+    {
+      // The clock alone is still better than a fixed seed
+    }
+    std::seed_seq seq{static_cast<std::uint32_t>(entropy),
+                      static_cast<std::uint32_t>(entropy >> 32)};
+    std::mt19937_64 generator(seq);
+    seed1 = generator();
+    seed2 = generator();
+  }
+
+  std::uint64_t seed1;
+  std::uint64_t seed2;
+};
+
+const Seeds& seeds()
+{
+  static const Seeds instance;
+  return instance;
+}
+
+inline std::uint64_t mix(std::uint64_t h) noexcept
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// Two independent lanes give a 128-bit key
+struct Hasher
+{
+  std::uint64_t lane1;
+  std::uint64_t lane2;
+
+  void add(std::uint64_t word) noexcept
+  {
+    lane1 = mix(lane1 ^ word);
+    lane2 = mix(lane2 + word * 0x9e3779b97f4a7c15ULL);
+  }
+
+  // The length is included to keep the boundaries between strings unambiguous
+  void add(std::string_view str) noexcept
+  {
+    add(static_cast<std::uint64_t>(str.size()));
+    std::size_t pos = 0;
+    for (; pos + sizeof(std::uint64_t) <= str.size(); pos += sizeof(std::uint64_t))
+    {
+      std::uint64_t word;
+      std::memcpy(&word, str.data() + pos, sizeof(word));
+      add(word);
+    }
+    if (pos < str.size())
+    {
+      std::uint64_t word = 0;
+      std::memcpy(&word, str.data() + pos, str.size() - pos);
+      add(word);
+    }
+  }
+};
+
+}  // namespace
+
+DecisionCache::DecisionCache(std::size_t entries) : itsEntries(1)
+{
+  try
+  {
+    while (itsEntries < entries)
+      itsEntries *= 2;
+
+    // Initialize the seeds now instead of on the first lookup
+    seeds();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+DecisionCache::Key DecisionCache::makeKey(std::string_view service,
+                                          std::string_view apikey,
+                                          std::string_view value,
+                                          bool explicitGrantOnly) noexcept
+{
+  const auto& s = seeds();
+  Hasher hasher{s.seed1, s.seed2};
+  hasher.add(service);
+  hasher.add(apikey);
+  hasher.add(value);
+  hasher.add(static_cast<std::uint64_t>(explicitGrantOnly));
+  return Key{hasher.lane1, hasher.lane2};
+}
+
+DecisionCache::Entry& DecisionCache::slot(const Key& key) const
+{
+  auto& table = threadTable();
+
+  // Caches of different sizes in the same process share the largest table. Entries are tagged
+  // with the snapshot generation, which is unique within the process, hence they never mix.
+  if (table.entries.size() < itsEntries)
+    table.entries.assign(itsEntries, Entry());
+
+  return table.entries[key.key1 & (table.entries.size() - 1)];
+}
+
+void DecisionCache::count(bool hit) const noexcept
+{
+  auto& table = threadTable();
+  auto& counter = (hit ? table.hits : table.misses);
+  counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+DecisionCache::Statistics DecisionCache::statistics() const
+{
+  try
+  {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    Statistics ret;
+    ret.hits = reg.retiredHits;
+    ret.misses = reg.retiredMisses;
+    for (const auto* table : reg.tables)
+    {
+      ret.hits += table->hits.load(std::memory_order_relaxed);
+      ret.misses += table->misses.load(std::memory_order_relaxed);
+    }
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
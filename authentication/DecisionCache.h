@@ -0,0 +1,117 @@
+#pragma once
+
+#include "CoarseClock.h"
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Per-thread cache of recent authorization decisions
+ *
+ * Each thread has a direct mapped table of its own, hence lookups need
+ * no synchronization at all. Entries are keyed by a 128-bit hash of the
+ * (service, apikey, value, explicitGrantOnly) tuple, seeded randomly at
+ * startup so that colliding keys cannot be crafted in advance, and are
+ * tagged with the generation of the snapshot they were resolved in.
+ * Publishing a new snapshot thus invalidates all entries at once without
+ * touching them. Entries also expire with the grants they were based on.
+ */
+// ----------------------------------------------------------------------
+
+class DecisionCache
+{
+ public:
+  struct Statistics
+  {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+  };
+
+  // Result of resolve(), valid until the given epoch second. The outcome is not interpreted,
+  // it is merely returned with the cached decision.
+  struct Decision
+  {
+    bool allowed;
+    std::int64_t expires;
+    std::uint8_t outcome = 0;
+  };
+
+  // Number of entries per thread, rounded up to a power of two
+  explicit DecisionCache(std::size_t entries);
+
+  // Cached decision, or the decision returned by resolve() which is then cached
+  template <typename Resolve>
+  Decision find(std::uint32_t generation,
+                std::string_view service,
+                std::string_view apikey,
+                std::string_view value,
+                bool explicitGrantOnly,
+                Resolve&& resolve) const
+  {
+    const auto key = makeKey(service, apikey, value, explicitGrantOnly);
+    auto& entry = slot(key);
+    if (entry.generation == generation && entry.key1 == key.key1 && entry.key2 == key.key2 &&
+        CoarseClock::now() < entry.expires)
+    {
+      count(true);
+      return Decision{entry.allowed, entry.expires, entry.outcome};
+    }
+
+    count(false);
+    const Decision decision = resolve();
+    entry.key1 = key.key1;
+    entry.key2 = key.key2;
+    entry.expires = decision.expires;
+    entry.generation = generation;
+    entry.allowed = decision.allowed;
+    entry.outcome = decision.outcome;
+    return decision;
+  }
+
+  // Totals over all threads of the process
+  Statistics statistics() const;
+
+  // Size of the table of a single thread
+  std::size_t entries() const { return itsEntries; }
+
+  struct Entry
+  {
+    std::uint64_t key1 = 0;
+    std::uint64_t key2 = 0;
+    std::int64_t expires = 0;
+    std::uint32_t generation = 0;  // snapshot generations are never zero
+    bool allowed = false;
+    std::uint8_t outcome = 0;
+  };
+
+ private:
+  struct Key
+  {
+    std::uint64_t key1;
+    std::uint64_t key2;
+  };
+
+  static Key makeKey(std::string_view service,
+                     std::string_view apikey,
+                     std::string_view value,
+                     bool explicitGrantOnly) noexcept;
+
+  // The entry of this thread for the key
+  Entry& slot(const Key& key) const;
+
+  // Update the counters of this thread
+  void count(bool hit) const noexcept;
+
+  std::size_t itsEntries;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
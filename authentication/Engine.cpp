@@ -1,13 +1,25 @@
 #include "Engine.h"
+#include "CoarseClock.h"
 #include "Config.h"
+#include "DataSource.h"
+#include "DecisionCache.h"
+#include "ExpiryWheel.h"
+#include "Metrics.h"
+#include "QuotaTable.h"
+#include "Snapshot.h"
+#include "SnapshotPointer.h"
 #include <macgyver/AnsiEscapeCodes.h>
 #include <macgyver/AsyncTask.h>
 #include <macgyver/Exception.h>
-#include <macgyver/PostgreSQLConnection.h>
 #include <macgyver/StringConversion.h>
 #include <macgyver/TypeName.h>
 #include <spine/Convenience.h>
 #include <spine/Reactor.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
 #include <utility>
 
 namespace SmartMet
@@ -16,114 +28,439 @@ namespace Engine
 {
 namespace Authentication
 {
-const std::string WILDCARD_IDENTIFIER = "*";
-
-// Enum to signify access resolution status
-enum class AccessStatus : std::uint8_t
+namespace
 {
-  WILDCARD_GRANT,
-  GRANT,
-  DENY,
-  UNKNOWN_APIKEY
-};
-
-// Token class
-// Describes a singe authorization token, which has zero or more token values
-class Token
+// Id cached in a handle, looked up again if the handle was resolved in another snapshot.
+// The generation is stored in the high and the id in the low 32 bits of the cache.
+template <typename Lookup>
+std::uint32_t resolveId(const ResolvedName& handle, const Snapshot& snapshot, Lookup&& lookup)
 {
- public:
-  explicit Token(std::string name) : itsName(std::move(name)) {}
-
-  bool addValue(const std::string& value) const;  // Constness here is hack, because std::set only
-                                                  // has const_iterators
-
-  void deleteValue(const std::string& value);
-
-  bool hasValue(const std::string& value) const;
-
-  bool operator<(const Token& other) const;
-
-  bool operator==(const Token& other) const;
-
-  bool operator!=(const Token& other) const;
-
- private:
-  std::string itsName;
-
-  mutable std::set<std::string> itsValues;  // Hack, because std::set allows only const_iterators
-};
+  const std::uint64_t generation = snapshot.generation();
+  const auto cache = handle.cache();
+  if ((cache >> 32) == generation)
+    return static_cast<std::uint32_t>(cache);
+
+  const std::uint32_t id = lookup(handle.name());
+  handle.setCache((generation << 32) | id);
+  return id;
+}
 
-bool Token::addValue(const std::string& value) const
+const ServiceIndex* findService(const Snapshot& snapshot, const ServiceHandle& service)
 {
-  return itsValues.insert(value).second;
+  return snapshot.findById(resolveId(
+      service, snapshot, [&snapshot](const std::string& name) { return snapshot.findId(name); }));
 }
-void Token::deleteValue(const std::string& value)
+
+// Service of an apikey handle, which a default constructed handle does not have
+const ServiceHandle& serviceOf(const ApikeyHandle& apikey)
 {
-  itsValues.erase(value);
+  if (!apikey.hasService())
+    throw Fmi::Exception(BCP, "Apikey handle without a service");
+  return apikey.service();
 }
-bool Token::hasValue(const std::string& value) const
+
+std::uint32_t findApikey(const Snapshot& snapshot,
+                         const ServiceIndex& index,
+                         const ApikeyHandle& apikey)
 {
-  return (itsValues.find(value) != itsValues.end());
+  return resolveId(
+      apikey, snapshot, [&](const std::string& name) { return snapshot.findApikey(index, name); });
 }
 
-bool Token::operator<(const Token& other) const
+double secondsSince(std::chrono::steady_clock::time_point start)
 {
-  return itsName < other.itsName;
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
-bool Token::operator==(const Token& other) const
+
+// Sizes of the snapshot for the update statistics
+void measure(RebuildMetrics& rebuild, const Snapshot& snapshot)
 {
-  return itsName == other.itsName;
+  const auto stats = snapshot.statistics();
+  rebuild.services = snapshot.services().size();
+  rebuild.apikeys = stats.apikeys;
+  rebuild.snapshotBytes = stats.imageSize + stats.filterBytes;
 }
-bool Token::operator!=(const Token& other) const
+
+// Message of the exception being handled
+std::string currentError()
 {
-  return itsName != other.itsName;
+  try
+  {
+    throw;
+  }
+  catch (const std::exception& e)
+  {
+    return e.what();
+  }
+  catch (...)
+  {
+    return "Unknown exception";
+  }
 }
-// Type to signify that all token values are valid
-struct WildCard
+
+// Ends the update round of a data source, unsuccessfully unless committed
+class Round
 {
+ public:
+  explicit Round(DataSource& source) : itsSource(source) { itsSource.begin(); }
+
+  ~Round()
+  {
+    if (!itsCommitted)
+      itsSource.end(false);
+  }
+
+  Round(const Round& other) = delete;
+  Round& operator=(const Round& other) = delete;
+  Round(Round&& other) = delete;
+  Round& operator=(Round&& other) = delete;
+
+  void commit()
+  {
+    itsCommitted = true;
+    itsSource.end(true);
+  }
+
+ private:
+  DataSource& itsSource;
+  bool itsCommitted = false;
 };
 
-// Service class
-// Tracks apikey-> token value relationships for a single service definition
-// This object can be queried if a given apikey has access to a number of token values
-class Service
+}  // namespace
+
+class AuthEngine final : public Engine
 {
  public:
-  explicit Service(std::string name) : itsName(std::move(name)) {}
+  explicit AuthEngine(const char* theConfigFile);
+
+  ~AuthEngine() override = default;
+
+  AuthEngine(const AuthEngine& other) = delete;
+  AuthEngine& operator=(const AuthEngine& other) = delete;
+  AuthEngine(AuthEngine&& other) = delete;
+  AuthEngine& operator=(AuthEngine&& other) = delete;
 
-  bool addToken(const std::string& apikey, const Token& token);
+  void init() override;
+  void shutdown() override;
 
-  bool addTokenSet(const std::string& apikey, const std::set<Token>& tokens);
+  bool isEnabled() const override
+  {
+    return true;  // This implementation is for enabled engine
+  }
 
-  bool addWildCard(const std::string& apikey);
+  // Query if given apikey has access to a number of token values for a given service
+  bool authorize(const std::string& apikey,
+                 const std::vector<std::string>& tokenvalues,
+                 const std::string& service) const override;
 
-  AccessStatus resolveAccess(const std::string& apikey,
-                             const std::string& value,
-                             bool explicitGrantOnly = false) const;
+  bool authorize(std::string_view apikey,
+                 TokenValueSpan tokenvalues,
+                 std::string_view service) const override;
+
+  // Authorize a single value for given service
+  bool authorize(std::string_view apikey,
+                 std::string_view tokenvalue,
+                 std::string_view service,
+                 bool explicitGrantOnly = false) const override;
+
+  std::vector<bool> authorizeEach(std::string_view apikey,
+                                  const std::vector<std::string>& tokenvalues,
+                                  std::string_view service) const override;
+
+  std::vector<bool> authorizeEach(std::string_view apikey,
+                                  TokenValueSpan tokenvalues,
+                                  std::string_view service) const override;
+
+  std::vector<bool> authorizeBatch(
+      const std::vector<AuthorizationRequest>& requests) const override;
+
+  bool consume(std::string_view apikey, std::string_view service) const override;
+
+  std::uint64_t generation() const override { return itsGeneration.load(); }
+
+  EngineMetrics metrics() const override { return itsMetrics.report(itsConfig.metrics); }
+
+  void setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants) override;
+
+  std::size_t subscribe(ChangeCallback callback) override;
+
+  void unsubscribe(std::size_t id) override;
+
+  ServiceHandle resolveService(const std::string& service) const override;
+
+  ApikeyHandle resolveApikey(const ServiceHandle& service,
+                             const std::string& apikey) const override;
+
+  bool authorize(const ApikeyHandle& apikey,
+                 const std::vector<std::string>& tokenvalues) const override;
+
+  bool authorize(const ApikeyHandle& apikey, TokenValueSpan tokenvalues) const override;
+
+  bool authorize(const ApikeyHandle& apikey,
+                 std::string_view tokenvalue,
+                 bool explicitGrantOnly = false) const override;
+
+  std::vector<bool> authorizeEach(const ApikeyHandle& apikey,
+                                  const std::vector<std::string>& tokenvalues) const override;
+
+  std::vector<bool> authorizeEach(const ApikeyHandle& apikey,
+                                  TokenValueSpan tokenvalues) const override;
 
  private:
-  std::string itsName;
+  // Final decision on a single value of a known service
+  bool isAllowed(AccessStatus status) const;
+
+  // The status deciding all the values of a known service, GRANT if every value is granted
+  template <typename Values>
+  AccessStatus decide(const ServiceIndex& index,
+                      std::uint32_t apikeyId,
+                      const Values& values) const;
+
+  // Verdicts of all the values, nullptr index means an unknown service
+  template <typename Values>
+  std::vector<bool> verdicts(std::string_view service,
+                             const ServiceIndex* index,
+                             std::uint32_t apikeyId,
+                             const Values& values,
+                             std::int64_t start) const;
+
+  // Start time of a call if metrics are enabled, zero otherwise
+  std::int64_t metricsStart() const { return (itsConfig.metrics ? Metrics::now() : 0); }
+
+  // Count the outcome of a call started at the given time, unless metrics are disabled
+  void record(std::string_view service, std::size_t outcome, std::int64_t start) const
+  {
+    if (start == 0)
+      return;
+    itsMetrics.count(service, outcome);
+    itsMetrics.latency(start);
+  }
+
+  // Authorize values through an apikey handle
+  template <typename Values>
+  bool authorizeHandle(const ApikeyHandle& apikey, const Values& values) const;
+
+  // Authorize values by name
+  template <typename Values>
+  bool authorizeNames(std::string_view apikey,
+                      const Values& values,
+                      std::string_view service) const;
+
+  // Rebuilds apikey service mappings and records the outcome in the update statistics
+  void rebuildMappings();
+
+  // Reads the changes or the tables, and takes the new mappings into use
+  void updateMappings();
+
+  // Warm start from the snapshot file, returns false if there is no usable file
+  bool loadSnapshotFile();
+
+  // Pick up a new generation of the snapshot file written by another process
+  void followSnapshotFile();
+
+  // Save the snapshot file if enabled and publish the snapshot, possibly remapped from the file
+  void publishSnapshot(std::unique_ptr<const Snapshot> snapshot);
+
+  // Record that the snapshot file is still current, so that it does not expire while the data
+  // stays unchanged
+  void markSnapshotFileChecked();
+
+  // Take the snapshot into use, increment the generation and notify the subscribers
+  void swapSnapshot(std::unique_ptr<const Snapshot> snapshot);
+
+  // Updates mappings in the background
+  void rebuildUpdateLoop();
+
+  // Advances the coarse clock once per second
+  void clockLoop();
+
+  // Schedule the removal of all expiring grants of the active snapshot
+  void scheduleExpiries();
+
+  // Drop the grants which have expired from the active snapshot
+  void removeExpiredGrants();
+
+  // Apply changes of the data source to the active snapshot
+  void applyChanges(const std::vector<RowChange>& changes);
+
+  // Take the quotas into use if they have changed
+  void updateQuotas(QuotaData quotas);
+
+  Config itsConfig;
+
+  // Source of the authorization data, used only by the update task apart from setData()
+  std::unique_ptr<DataSource> itsSource;
+
+  // Fingerprint of the source data the active mappings were built from
+  std::string itsDataVersion;
+
+  // Identity of the snapshot file generation last loaded or written
+  std::string itsSnapshotFileVersion;
+
+  // Whether the snapshot file holds the active mappings, false if the latest write failed
+  bool itsSnapshotFileCurrent = false;
+
+  // Optional cache of single value decisions, invalidated by snapshot swaps
+  std::unique_ptr<DecisionCache> itsDecisionCache;
+
+  // Totals of the decision cache at the previous full reload, used only by the update task
+  DecisionCache::Statistics itsLoggedCacheStats;
 
-  std::set<std::string> itsWildCardApikeys;
+  // Counters of the authorization calls and statistics of the updates
+  Metrics itsMetrics;
 
-  // Apikey -> one or more token definitions
-  std::map<std::string, std::set<Token>> itsTokenApikeyMapping;
+  // Duration of the latest swap, used only by the update task
+  double itsSwapSeconds = 0;
+
+  // Currently active mappings, swapped in atomically by rebuildMappings()
+  SnapshotPointer<Snapshot> itsSnapshot;
+
+  // Request quotas, replaced only when the quota table changes so that the buckets are kept
+  SnapshotPointer<QuotaTable> itsQuotas;
+
+  // Incremented after each swap, never before, so that a caller who reads the generation
+  // before using the engine never pairs an old result with a new generation
+  std::atomic<std::uint64_t> itsGeneration{0};
+
+  std::mutex itsSubscriberMutex;
+  std::map<std::size_t, ChangeCallback> itsSubscribers;
+  std::size_t itsNextSubscriberId = 1;
+
+  // Expiry times of the grants in the active mappings, used only by the update task
+  ExpiryWheel itsExpiryWheel;
+
+  std::unique_ptr<Fmi::AsyncTask> itsUpdateTask;
+  std::unique_ptr<Fmi::AsyncTask> itsClockTask;
+
+  int itsActiveThreadCount = 0;
 };
 
-bool Service::addToken(const std::string& apikey, const Token& token)
+AuthEngine::AuthEngine(const char* theConfigFile)
+    : itsConfig(theConfigFile), itsSource(DataSource::create(itsConfig))
+{
+  itsSnapshot.publish(std::make_unique<Snapshot>());
+  itsQuotas.publish(std::make_unique<QuotaTable>());
+
+  if (itsConfig.decisionCache)
+    itsDecisionCache = std::make_unique<DecisionCache>(std::max(itsConfig.decisionCacheEntries, 1));
+}
+
+bool AuthEngine::authorize(std::string_view apikey,
+                           std::string_view tokenvalue,
+                           std::string_view service,
+                           bool explicitGrantOnly) const
+{
+  try
+  {
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+
+    auto resolve = [&]() {
+      const auto* index = snapshot->find(service);
+      if (index)
+      {
+        const auto apikeyId = snapshot->findApikey(*index, apikey);
+        const auto status = index->resolveAccessById(apikeyId, tokenvalue, explicitGrantOnly);
+        return DecisionCache::Decision{isAllowed(status),
+                                       index->expires(apikeyId),
+                                       static_cast<std::uint8_t>(Metrics::outcome(status))};
+      }
+
+      // Unkown service, either there is a plugin programming error or no access tokens are
+      // defined for this service
+      return DecisionCache::Decision{
+          !explicitGrantOnly, NO_EXPIRY, static_cast<std::uint8_t>(Metrics::UNKNOWN_SERVICE)};
+    };
+
+    const auto decision =
+        (itsDecisionCache ? itsDecisionCache->find(snapshot->generation(),
+                                                   service,
+                                                   apikey,
+                                                   tokenvalue,
+                                                   explicitGrantOnly,
+                                                   resolve)
+                          : resolve());
+    record(service, decision.outcome, start);
+    return decision.allowed;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool AuthEngine::isAllowed(AccessStatus status) const
+{
+  switch (status)
+  {
+    case AccessStatus::UNKNOWN_APIKEY:
+      // Unknown apikey for this aservice
+      // Default access policy is "allow", unknown apikey is let through
+      return itsConfig.defaultAccessAllow;
+    case AccessStatus::DENY:
+      return false;
+    case AccessStatus::GRANT:
+    case AccessStatus::WILDCARD_GRANT:
+    default:  // Dummy case, for compiler
+      return true;
+  }
+}
+
+std::vector<bool> AuthEngine::authorizeBatch(
+    const std::vector<AuthorizationRequest>& requests) const
 {
   try
   {
-    auto it = itsTokenApikeyMapping.find(apikey);
+    std::vector<bool> ret;
+    ret.reserve(requests.size());
+
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+
+    // Consecutive requests usually share the service and often the apikey
+    std::string_view service;
+    std::string_view apikey;
+    const ServiceIndex* index = nullptr;
+    std::uint32_t apikeyId = StringTable::npos;
+    bool haveService = false;
+    bool haveApikey = false;
 
-    if (it == itsTokenApikeyMapping.end())
+    for (const auto& request : requests)
     {
-      // No such apikey yet
-      return itsTokenApikeyMapping.insert(std::make_pair(apikey, std::set<Token>{token})).second;
+      if (!haveService || request.service != service)
+      {
+        service = request.service;
+        index = snapshot->find(service);
+        haveService = true;
+        haveApikey = false;
+      }
+
+      if (!index)
+      {
+        // Unknown service
+        ret.push_back(!request.explicitGrantOnly);
+        if (start != 0)
+          itsMetrics.count(service, Metrics::UNKNOWN_SERVICE);
+        continue;
+      }
+
+      if (!haveApikey || request.apikey != apikey)
+      {
+        apikey = request.apikey;
+        apikeyId = snapshot->findApikey(*index, apikey);
+        haveApikey = true;
+      }
+
+      const auto status =
+          index->resolveAccessById(apikeyId, request.tokenvalue, request.explicitGrantOnly);
+      ret.push_back(isAllowed(status));
+      if (start != 0)
+        itsMetrics.count(service, Metrics::outcome(status));
     }
 
-    auto& tokenSet = it->second;
-    return tokenSet.insert(token).second;
+    if (start != 0)
+      itsMetrics.latency(start);
+    return ret;
   }
   catch (...)
   {
@@ -131,11 +468,12 @@ bool Service::addToken(const std::string& apikey, const Token& token)
   }
 }
 
-bool Service::addTokenSet(const std::string& apikey, const std::set<Token>& tokens)
+bool AuthEngine::consume(std::string_view apikey, std::string_view service) const
 {
   try
   {
-    return itsTokenApikeyMapping.insert(std::make_pair(apikey, tokens)).second;
+    const auto quotas = itsQuotas.read();
+    return quotas->consume(service, apikey);
   }
   catch (...)
   {
@@ -143,11 +481,14 @@ bool Service::addTokenSet(const std::string& apikey, const std::set<Token>& toke
   }
 }
 
-bool Service::addWildCard(const std::string& apikey)
+ServiceHandle AuthEngine::resolveService(const std::string& service) const
 {
   try
   {
-    return itsWildCardApikeys.insert(apikey).second;
+    ServiceHandle handle(service);
+    const auto snapshot = itsSnapshot.read();
+    findService(*snapshot, handle);
+    return handle;
   }
   catch (...)
   {
@@ -155,35 +496,43 @@ bool Service::addWildCard(const std::string& apikey)
   }
 }
 
-AccessStatus Service::resolveAccess(const std::string& apikey,
-                                    const std::string& value,
-                                    bool explicitGrantOnly) const
+ApikeyHandle AuthEngine::resolveApikey(const ServiceHandle& service,
+                                       const std::string& apikey) const
 {
   try
   {
-    // First check if this apikey has "wildcard" definition, it means universal access
-    if (!explicitGrantOnly && (itsWildCardApikeys.find(apikey) != itsWildCardApikeys.end()))
-      return AccessStatus::WILDCARD_GRANT;
-
-    // Next check if value is found in token definitions for this apikey
-    auto it = itsTokenApikeyMapping.find(apikey);
-
-    if (it == itsTokenApikeyMapping.end())
-    {
-      // No such apikey defined for this service.
-      return explicitGrantOnly ? AccessStatus::DENY : AccessStatus::UNKNOWN_APIKEY;
-    }
-
-    const auto& tokens = it->second;
+    ApikeyHandle handle(service, apikey);
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = findService(*snapshot, service);
+    if (index)
+      findApikey(*snapshot, *index, handle);
+    return handle;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    // See if value is defined in one of the token sets:
-    for (const auto& token : tokens)
+bool AuthEngine::authorize(const ApikeyHandle& apikey,
+                           std::string_view tokenvalue,
+                           bool explicitGrantOnly) const
+{
+  try
+  {
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = findService(*snapshot, serviceOf(apikey));
+    if (!index)
     {
-      if (token.hasValue(value))
-        return AccessStatus::GRANT;
+      record(apikey.service().name(), Metrics::UNKNOWN_SERVICE, start);
+      return !explicitGrantOnly;  // Unknown service
     }
 
-    return AccessStatus::DENY;
+    const auto apikeyId = findApikey(*snapshot, *index, apikey);
+    const auto status = index->resolveAccessById(apikeyId, tokenvalue, explicitGrantOnly);
+    record(apikey.service().name(), Metrics::outcome(status), start);
+    return isAllowed(status);
   }
   catch (...)
   {
@@ -191,87 +540,140 @@ AccessStatus Service::resolveAccess(const std::string& apikey,
   }
 }
 
-class AuthEngine final : public Engine
+template <typename Values>
+AccessStatus AuthEngine::decide(const ServiceIndex& index,
+                                std::uint32_t apikeyId,
+                                const Values& values) const
 {
- public:
-  explicit AuthEngine(const char* theConfigFile);
-
-  ~AuthEngine() override = default;
-
-  AuthEngine(const AuthEngine& other) = delete;
-  AuthEngine& operator=(const AuthEngine& other) = delete;
-  AuthEngine(AuthEngine&& other) = delete;
-  AuthEngine& operator=(AuthEngine&& other) = delete;
-
-  void init() override;
-  void shutdown() override;
-
-  bool isEnabled() const override
+  for (const auto& value : values)
   {
-    return true;  // This implementation is for enabled engine
-  }
+    // Let through if all tokens are valid
+    AccessStatus value_status = index.resolveAccessById(apikeyId, value);
 
-  // Query if given apikey has access to a number of token values for a given service
-  bool authorize(const std::string& apikey,
-                 const std::vector<std::string>& tokenvalues,
-                 const std::string& service) const override;
+    switch (value_status)
+    {
+      case AccessStatus::UNKNOWN_APIKEY:
+      {
+        // Unknown apikey for this aservice, decided by the default access policy
+        return value_status;
+      }
+      case AccessStatus::DENY:
+      {
+        // Disallowed value encountered, deny access;
+        return value_status;
+      }
+      case AccessStatus::GRANT:
+      {
+        // Allowed value, continue to the next
+        continue;
+      }
+      case AccessStatus::WILDCARD_GRANT:
+      {
+        // This apikey has universal access, no reason to loop through all token values
+        return value_status;
+      }
+    }
+  }
 
-  // Authorize a single value for given service
-  bool authorize(const std::string& apikey,
-                 const std::string& tokenvalue,
-                 const std::string& service,
-                 bool explicitGrantOnly = false) const override;
+  // All tokens valid
+  return AccessStatus::GRANT;
+}
 
- private:
-  // Rebuilds apikey service mappings
-  void rebuildMappings();
+template <typename Values>
+bool AuthEngine::authorizeNames(std::string_view apikey,
+                                const Values& values,
+                                std::string_view service) const
+{
+  try
+  {
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
 
-  // Updates mappings in the background
-  void rebuildUpdateLoop();
+    const auto* index = snapshot->find(service);
+    if (!index)
+    {
+      record(service, Metrics::UNKNOWN_SERVICE, start);
+      return true;  // Unknown service, let through
+    }
 
-  Config itsConfig;
+    const auto status = decide(*index, snapshot->findApikey(*index, apikey), values);
+    record(service, Metrics::outcome(status), start);
+    return isAllowed(status);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-  // Service name -> Service definition
-  std::map<std::string, Service> itsServices;
+template <typename Values>
+bool AuthEngine::authorizeHandle(const ApikeyHandle& apikey, const Values& values) const
+{
+  try
+  {
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = findService(*snapshot, serviceOf(apikey));
+    if (!index)
+    {
+      record(apikey.service().name(), Metrics::UNKNOWN_SERVICE, start);
+      return true;  // Unknown service, let through
+    }
 
-  mutable SmartMet::Spine::MutexType itsMutex;
+    const auto status = decide(*index, findApikey(*snapshot, *index, apikey), values);
+    record(apikey.service().name(), Metrics::outcome(status), start);
+    return isAllowed(status);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-  std::unique_ptr<Fmi::AsyncTask> itsUpdateTask;
+template <typename Values>
+std::vector<bool> AuthEngine::verdicts(std::string_view service,
+                                       const ServiceIndex* index,
+                                       std::uint32_t apikeyId,
+                                       const Values& values,
+                                       std::int64_t start) const
+{
+  // Unknown services are let through
+  std::vector<bool> ret(values.size(), true);
+  if (!index)
+  {
+    if (start != 0)
+    {
+      itsMetrics.count(service, Metrics::UNKNOWN_SERVICE, values.size());
+      itsMetrics.latency(start);
+    }
+    return ret;
+  }
 
-  int itsActiveThreadCount = 0;
-};
+  std::size_t i = 0;
+  for (const auto& value : values)
+  {
+    const auto status = index->resolveAccessById(apikeyId, value);
+    ret[i++] = isAllowed(status);
+    if (start != 0)
+      itsMetrics.count(service, Metrics::outcome(status));
+  }
 
-AuthEngine::AuthEngine(const char* theConfigFile) : itsConfig(theConfigFile) {}
+  if (start != 0)
+    itsMetrics.latency(start);
+  return ret;
+}
 
-bool AuthEngine::authorize(const std::string& apikey,
-                           const std::string& tokenvalue,
-                           const std::string& service,
-                           bool explicitGrantOnly) const
+std::vector<bool> AuthEngine::authorizeEach(std::string_view apikey,
+                                            const std::vector<std::string>& tokenvalues,
+                                            std::string_view service) const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
-    auto it = itsServices.find(service);
-    if (it != itsServices.end())
-    {
-      AccessStatus value_status = it->second.resolveAccess(apikey, tokenvalue, explicitGrantOnly);
-      switch (value_status)
-      {
-        case AccessStatus::UNKNOWN_APIKEY:
-          // Unknown apikey for this aservice
-          // Default access policy is "allow", unknown apikey is let through
-          return itsConfig.defaultAccessAllow;
-        case AccessStatus::DENY:
-          return false;
-        case AccessStatus::GRANT:
-        case AccessStatus::WILDCARD_GRANT:
-        default:  // Dummy case, for compiler
-          return true;
-      }
-    }
-    else  // Unkown service, either there is a plugin programming error or no access tokens are
-          // defined for this service
-      return !explicitGrantOnly;
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = snapshot->find(service);
+    const auto apikeyId = (index ? snapshot->findApikey(*index, apikey) : StringTable::npos);
+    return verdicts(service, index, apikeyId, tokenvalues, start);
   }
   catch (...)
   {
@@ -279,51 +681,51 @@ bool AuthEngine::authorize(const std::string& apikey,
   }
 }
 
-bool AuthEngine::authorize(const std::string& apikey,
-                           const std::vector<std::string>& tokenvalues,
-                           const std::string& service) const
+std::vector<bool> AuthEngine::authorizeEach(std::string_view apikey,
+                                            TokenValueSpan tokenvalues,
+                                            std::string_view service) const
 {
   try
   {
-    SmartMet::Spine::ReadLock lock(itsMutex);
-
-    auto it = itsServices.find(service);
-    if (it == itsServices.end())
-      return true;  // Unknown service, let through
-
-    for (const std::string& value : tokenvalues)
-    {
-      // Let through if all tokens are valid
-      AccessStatus value_status = it->second.resolveAccess(apikey, value);
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = snapshot->find(service);
+    const auto apikeyId = (index ? snapshot->findApikey(*index, apikey) : StringTable::npos);
+    return verdicts(service, index, apikeyId, tokenvalues, start);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-      switch (value_status)
-      {
-        case AccessStatus::UNKNOWN_APIKEY:
-        {
-          // Unknown apikey for this aservice
-          // Default access policy is "allow", unknown apikey is let through
-          return itsConfig.defaultAccessAllow;
-        }
-        case AccessStatus::DENY:
-        {
-          // Disallowed value encountered, deny access;
-          return false;
-        }
-        case AccessStatus::GRANT:
-        {
-          // Allowed value, continue to the next
-          continue;
-        }
-        case AccessStatus::WILDCARD_GRANT:
-        {
-          // This apikey has universal access, no reason to loop through all token values
-          return true;
-        }
-      }
-    }
+std::vector<bool> AuthEngine::authorizeEach(const ApikeyHandle& apikey,
+                                            const std::vector<std::string>& tokenvalues) const
+{
+  try
+  {
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = findService(*snapshot, serviceOf(apikey));
+    const auto apikeyId = (index ? findApikey(*snapshot, *index, apikey) : StringTable::npos);
+    return verdicts(apikey.service().name(), index, apikeyId, tokenvalues, start);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    // All tokens valid
-    return true;
+std::vector<bool> AuthEngine::authorizeEach(const ApikeyHandle& apikey,
+                                            TokenValueSpan tokenvalues) const
+{
+  try
+  {
+    const auto start = metricsStart();
+    const auto snapshot = itsSnapshot.read();
+    const auto* index = findService(*snapshot, serviceOf(apikey));
+    const auto apikeyId = (index ? findApikey(*snapshot, *index, apikey) : StringTable::npos);
+    return verdicts(apikey.service().name(), index, apikeyId, tokenvalues, start);
   }
   catch (...)
   {
@@ -331,11 +733,48 @@ bool AuthEngine::authorize(const std::string& apikey,
   }
 }
 
+bool AuthEngine::authorize(const ApikeyHandle& apikey,
+                           const std::vector<std::string>& tokenvalues) const
+{
+  return authorizeHandle(apikey, tokenvalues);
+}
+
+bool AuthEngine::authorize(const ApikeyHandle& apikey, TokenValueSpan tokenvalues) const
+{
+  return authorizeHandle(apikey, tokenvalues);
+}
+
+bool AuthEngine::authorize(const std::string& apikey,
+                           const std::vector<std::string>& tokenvalues,
+                           const std::string& service) const
+{
+  return authorizeNames(apikey, tokenvalues, service);
+}
+
+bool AuthEngine::authorize(std::string_view apikey,
+                           TokenValueSpan tokenvalues,
+                           std::string_view service) const
+{
+  return authorizeNames(apikey, tokenvalues, service);
+}
+
 void AuthEngine::init()
 {
   try
   {
-    rebuildMappings();
+    CoarseClock::update();
+    itsClockTask.reset(new Fmi::AsyncTask("clk-auth", [this]() { clockLoop(); }));
+
+    // With a warm start the mappings are refreshed from the database in the background
+    if (!loadSnapshotFile())
+    {
+      if (itsConfig.snapshotFollower)
+        throw Fmi::Exception(BCP, "No usable snapshot file to follow")
+            .addParameter("File", itsConfig.snapshotFile);
+      rebuildMappings();
+    }
+    else if (!itsConfig.snapshotFollower)
+      scheduleExpiries();
 
     itsUpdateTask.reset(
         new Fmi::AsyncTask("upd-auth", [this]() { rebuildUpdateLoop(); }));
@@ -364,6 +803,13 @@ void AuthEngine::shutdown()
       itsUpdateTask->wait();
       itsUpdateTask.reset();
     }
+
+    if (itsClockTask)
+    {
+      itsClockTask->cancel();
+      itsClockTask->wait();
+      itsClockTask.reset();
+    }
   }
   catch (...)
   {
@@ -380,7 +826,10 @@ void AuthEngine::rebuildUpdateLoop()
     {
       try
       {
-        rebuildMappings();
+        if (itsConfig.snapshotFollower)
+          followSnapshotFile();
+        else
+          rebuildMappings();
       }
       catch (...)
       {
@@ -388,9 +837,15 @@ void AuthEngine::rebuildUpdateLoop()
         exception.printError();
       }
 
+      // Expired grants are dropped between the reloads. Followers get them dropped by the
+      // process writing the snapshot file, and meanwhile they are ignored by the lookups.
       for (int i = 0; (!Spine::Reactor::isShuttingDown() && i < itsConfig.updateIntervalSeconds);
            i++)
+      {
         boost::this_thread::sleep_for(boost::chrono::milliseconds(1000));
+        if (!itsConfig.snapshotFollower)
+          removeExpiredGrants();
+      }
     }
     itsActiveThreadCount--;
   }
@@ -400,99 +855,420 @@ void AuthEngine::rebuildUpdateLoop()
   }
 }
 
-void AuthEngine::rebuildMappings()
+void AuthEngine::clockLoop()
 {
-  using namespace Fmi::Database;
   try
   {
-    PostgreSQLConnectionOptions opt;
-    opt.host = itsConfig.dBHost;
-    opt.port = itsConfig.port;
-    opt.database = itsConfig.database;
-    opt.username = itsConfig.user;
-    opt.password = itsConfig.password;
+    while (!Spine::Reactor::isShuttingDown())
+    {
+      CoarseClock::update();
+      boost::this_thread::sleep_for(boost::chrono::milliseconds(1000));
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void AuthEngine::scheduleExpiries()
+{
+  try
+  {
+    std::vector<std::shared_ptr<const ServiceIndex>> services;
+    {
+      const auto snapshot = itsSnapshot.read();
+      services = snapshot->services();
+    }
+
+    itsExpiryWheel.reset(CoarseClock::now());
+    for (const auto& service : services)
+    {
+      if (service->statistics().expiringApikeys == 0)
+        continue;
+      for (const auto& expiry : service->expiries())
+        itsExpiryWheel.add(ExpiryWheel::Entry{
+            expiry.second, std::string(service->name()), expiry.first.first, expiry.first.second});
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void AuthEngine::removeExpiredGrants()
+{
+  try
+  {
+    const auto now = CoarseClock::now();
+    const auto due = itsExpiryWheel.advance(now);
+    if (due.empty())
+      return;
+
+    // Copy-on-write: only the services with expired grants are rebuilt
+    std::unique_ptr<SnapshotBuilder> builder;
+    std::size_t count = 0;
+    {
+      const auto snapshot = itsSnapshot.read();
+      builder = std::make_unique<SnapshotBuilder>(*snapshot, itsConfig.indexOptions);
+      for (const auto& entry : due)
+      {
+        // Grants renewed or removed since they were scheduled are left alone
+        const auto index = snapshot->get(entry.service);
+        if (!index || index->validUntil(entry.apikey, entry.token) > now)
+          continue;
+        builder->removeGrant(entry.apikey, entry.service, entry.token);
+        count++;
+      }
+    }
 
-    PostgreSQLConnection conn(opt);
+    if (count == 0)
+      return;
+
+    RebuildMetrics rebuild;
+    rebuild.kind = "expiry";
+    rebuild.rows = count;
+    const auto nservices = builder->modifiedCount();
+    const auto buildStart = std::chrono::steady_clock::now();
+    auto snapshot = builder->build();
+    rebuild.buildSeconds = secondsSince(buildStart);
+    measure(rebuild, *snapshot);
+    publishSnapshot(std::move(snapshot));
+    rebuild.swapSeconds = itsSwapSeconds;
+    itsMetrics.rebuilt(rebuild);
+
+    std::cout << Spine::log_time_str() << " Authentication engine: removed " << count
+              << " expired grants from " << nservices << " services\n";
+  }
+  catch (...)
+  {
+    Fmi::Exception exception(BCP, "Failed to remove expired grants", nullptr);
+    exception.printError();
+  }
+}
 
-    std::string query;
-    pqxx::result res;
+bool AuthEngine::loadSnapshotFile()
+{
+  if (itsConfig.snapshotFile.empty())
+    return false;
 
-    auto transaction = conn.transaction();
+  try
+  {
+    const auto version = Snapshot::fileVersion(itsConfig.snapshotFile);
+    auto snapshot = Snapshot::read(
+        itsConfig.snapshotFile, itsConfig.snapshotMaxAgeSeconds, itsConfig.snapshotMapped);
+    const auto nservices = snapshot->services().size();
+    swapSnapshot(std::move(snapshot));
+    itsSnapshotFileVersion = version;
+    itsSnapshotFileCurrent = true;
+    std::cout << Spine::log_time_str() << " Authentication engine: loaded " << nservices
+              << " services from " << itsConfig.snapshotFile << '\n';
+    return true;
+  }
+  catch (...)
+  {
+    Fmi::Exception exception(BCP, "Snapshot file not used", nullptr);
+    exception.printError();
+    return false;
+  }
+}
 
-    // Get token definitions
-    query =
-        "SELECT service,token,value from " + itsConfig.schema + "." + itsConfig.tokenTable + ";";
-    res = transaction->execute(query);
+void AuthEngine::followSnapshotFile()
+{
+  try
+  {
+    const auto version = Snapshot::fileVersion(itsConfig.snapshotFile);
+    if (!version.empty() && version != itsSnapshotFileVersion)
+      loadSnapshotFile();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    std::map<std::string, Service> newServices;
-    std::map<std::string, std::set<Token>> newTokens;
+void AuthEngine::markSnapshotFileChecked()
+{
+  if (itsConfig.snapshotFile.empty() || !itsSnapshotFileCurrent)
+    return;
 
-    // Construct token objects
-    for (auto row : res)
+  try
+  {
+    Snapshot::markChecked(itsConfig.snapshotFile);
+  }
+  catch (...)
+  {
+    Fmi::Exception exception(BCP, "Failed to mark snapshot file checked", nullptr);
+    exception.printError();
+  }
+}
+
+void AuthEngine::publishSnapshot(std::unique_ptr<const Snapshot> snapshot)
+{
+  try
+  {
+    if (!itsConfig.snapshotFile.empty())
+    {
+      try
+      {
+        itsSnapshotFileCurrent = false;
+        snapshot->write(itsConfig.snapshotFile);
+        itsSnapshotFileVersion = Snapshot::fileVersion(itsConfig.snapshotFile);
+        itsSnapshotFileCurrent = true;
+
+        // Serve from the new generation of the file, other processes may share its pages
+        if (itsConfig.snapshotMapped)
+          snapshot = Snapshot::read(
+              itsConfig.snapshotFile, itsConfig.snapshotMaxAgeSeconds, itsConfig.snapshotMapped);
+      }
+      catch (...)
+      {
+        Fmi::Exception exception(BCP, "Failed to save snapshot file", nullptr);
+        exception.printError();
+      }
+    }
+
+    swapSnapshot(std::move(snapshot));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void AuthEngine::swapSnapshot(std::unique_ptr<const Snapshot> snapshot)
+{
+  try
+  {
+    // Readers still using the old mappings are waited for before they are destroyed
+    const auto start = std::chrono::steady_clock::now();
+    itsSnapshot.publish(std::move(snapshot));
+    itsSwapSeconds = secondsSince(start);
+    const auto generation = ++itsGeneration;
+
+    // The callbacks are called without the lock so that they may unsubscribe themselves
+    std::vector<ChangeCallback> callbacks;
+    {
+      std::lock_guard<std::mutex> lock(itsSubscriberMutex);
+      for (const auto& subscriber : itsSubscribers)
+        callbacks.push_back(subscriber.second);
+    }
+
+    for (const auto& callback : callbacks)
     {
-      std::string value;
-      std::string service;
-      std::string token;
+      try
+      {
+        callback(generation);
+      }
+      catch (...)
+      {
+        Fmi::Exception exception(BCP, "Authorization change callback failed", nullptr);
+        exception.printError();
+      }
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-      // Indexing like so should be safe, database columns are 'not null'
-      row[0].to(service);
-      row[1].to(token);
-      row[2].to(value);
+std::size_t AuthEngine::subscribe(ChangeCallback callback)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsSubscriberMutex);
+    const auto id = itsNextSubscriberId++;
+    itsSubscribers.emplace(id, std::move(callback));
+    return id;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void AuthEngine::unsubscribe(std::size_t id)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsSubscriberMutex);
+    itsSubscribers.erase(id);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-      std::set<Token> tokens;
-      auto it = newTokens.insert(std::make_pair(service, tokens)).first;
+void AuthEngine::setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants)
+{
+  try
+  {
+    // Taken into use by the next update round
+    itsSource->setData(std::move(tokens), std::move(grants));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-      Token thisToken(token);
-      auto tokenIt = it->second.insert(thisToken).first;
+void AuthEngine::applyChanges(const std::vector<RowChange>& changes)
+{
+  try
+  {
+    // Copy-on-write: only the modified services are rebuilt, others are shared with the
+    // active snapshot
+    std::unique_ptr<SnapshotBuilder> builder;
+    {
+      const auto snapshot = itsSnapshot.read();
+      builder = std::make_unique<SnapshotBuilder>(*snapshot, itsConfig.indexOptions);
+    }
 
-      tokenIt->addValue(value);
+    for (const auto& change : changes)
+    {
+      applyChange(*builder, change);
+      if (change.grant && change.insert && change.validUntil != NO_EXPIRY)
+        itsExpiryWheel.add(
+            ExpiryWheel::Entry{change.validUntil, change.service, change.apikey, change.token});
     }
 
-    // Construct Service objects
-    query =
-        "SELECT apikey,service,token from " + itsConfig.schema + "." + itsConfig.authTable + ";";
-    res = transaction->execute(query);
+    RebuildMetrics rebuild;
+    rebuild.kind = "changelog";
+    rebuild.rows = changes.size();
+    const auto nservices = builder->modifiedCount();
+    const auto buildStart = std::chrono::steady_clock::now();
+    auto snapshot = builder->build();
+    rebuild.buildSeconds = secondsSince(buildStart);
+    measure(rebuild, *snapshot);
+    publishSnapshot(std::move(snapshot));
+    rebuild.swapSeconds = itsSwapSeconds;
+    itsMetrics.rebuilt(rebuild);
+
+    std::cout << Spine::log_time_str() << " Authentication engine: applied " << changes.size()
+              << " changes to " << nservices << " services\n";
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-    for (auto row : res)
+void AuthEngine::updateQuotas(QuotaData quotas)
+{
+  try
+  {
+    std::unique_ptr<const QuotaTable> table;
     {
-      std::string apikey;
-      std::string service;
-      std::string token;
+      const auto current = itsQuotas.read();
+      if (quotas == current->data())
+        return;
+      table = std::make_unique<const QuotaTable>(std::move(quotas), current.get());
+    }
 
-      // Indexing like so should be safe, database columns are 'not null'
-      row[0].to(apikey);
-      row[1].to(service);
-      row[2].to(token);
+    const auto nquotas = table->size();
+    itsQuotas.publish(std::move(table));
+    std::cout << Spine::log_time_str() << " Authentication engine: " << nquotas
+              << " request quotas\n";
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void AuthEngine::rebuildMappings()
+{
+  try
+  {
+    updateMappings();
+    itsMetrics.succeeded();
+  }
+  catch (...)
+  {
+    itsMetrics.failed(currentError());
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
 
-      // Check errors here!
+void AuthEngine::updateMappings()
+{
+  try
+  {
+    // All reads of the round see the same data. Should the round fail, the source discards
+    // whatever it read, for example a possibly broken database connection.
+    Round round(*itsSource);
 
-      Service newService(service);
-      auto it = newServices.insert(std::make_pair(service, newService)).first;
+    QuotaData quotas;
+    if (itsSource->quotas(quotas))
+      updateQuotas(std::move(quotas));
 
-      // Check if token name is the wildcard definition
-      if (token == WILDCARD_IDENTIFIER)
-      {
-        it->second.addWildCard(apikey);
-        continue;
-      }
+    RebuildMetrics rebuild;
+    rebuild.kind = "full";
+    const auto probeStart = std::chrono::steady_clock::now();
 
-      // Get defined tokens
-      auto tokenSetIt = newTokens.find(service);
-      if (tokenSetIt != newTokens.end())
-      {
-        auto tokenIt = tokenSetIt->second.find(
-            Token(token));  // Find the token object for this particular token name
-        if (tokenIt == tokenSetIt->second.end())
-          continue;                             // This is misconfiguration in the
-                                                // database
-        it->second.addToken(apikey, *tokenIt);  // This could be a pointer type to save
-                                                // space
-      }
+    std::vector<RowChange> changes;
+    if (itsSource->changes(changes))
+    {
+      if (!changes.empty())
+        applyChanges(changes);
+      round.commit();
+      if (changes.empty())
+        markSnapshotFileChecked();
+      return;
     }
 
-    SmartMet::Spine::WriteLock lock(itsMutex);
+    // Skip the reload if the data has not changed. Should it change after the probe, the next
+    // probe notices the difference and the data is reloaded again.
+    const auto version = itsSource->version();
+    if (!version.empty() && version == itsDataVersion)
+    {
+      round.commit();
+      markSnapshotFileChecked();
+      return;
+    }
+    rebuild.probeSeconds = secondsSince(probeStart);
+
+    const auto loadStart = std::chrono::steady_clock::now();
+    IndexSink sink(itsConfig.indexOptions);
+    itsSource->load(sink);
+    auto newSnapshot = sink.build();
+    rebuild.rows = sink.rows();
+    rebuild.buildSeconds = sink.buildSeconds();
+    rebuild.querySeconds = secondsSince(loadStart) - rebuild.buildSeconds;
+    const auto nservices = newSnapshot->services().size();
+    const auto stats = newSnapshot->statistics();
+    measure(rebuild, *newSnapshot);
+
+    publishSnapshot(std::move(newSnapshot));
+    itsDataVersion = version;
+    scheduleExpiries();
+    round.commit();
+    rebuild.swapSeconds = itsSwapSeconds;
+    itsMetrics.rebuilt(rebuild);
+
+    std::cout << Spine::log_time_str() << " Authentication engine: " << nservices
+              << " services, " << stats.apikeys << " apikeys, snapshot size " << stats.imageSize
+              << " bytes, " << stats.sharedBytes
+              << " bytes saved by sharing identical grant sets, " << stats.filterBytes
+              << " bytes of apikey filters, " << stats.expiringApikeys
+              << " apikeys with expiring grants\n";
+
+    if (itsDecisionCache)
+    {
+      const auto cacheStats = itsDecisionCache->statistics();
+      std::cout << Spine::log_time_str() << " Authentication engine: decision cache "
+                << cacheStats.hits - itsLoggedCacheStats.hits << " hits, "
+                << cacheStats.misses - itsLoggedCacheStats.misses
+                << " misses since the previous reload\n";
+      itsLoggedCacheStats = cacheStats;
+    }
 
-    std::swap(newServices, itsServices);
+    if (itsConfig.metrics)
+      std::cout << Spine::log_time_str() << " Authentication engine: "
+                << Metrics::summary(itsMetrics.report(true)) << '\n';
   }
   catch (...)
   {
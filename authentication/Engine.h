@@ -2,7 +2,15 @@
 
 #include <macgyver/Exception.h>
 #include <spine/SmartMetEngine.h>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 namespace SmartMet
@@ -11,6 +19,176 @@ namespace Engine
 {
 namespace Authentication
 {
+// Non-owning view to consecutive token values, like std::span<const std::string_view>
+class TokenValueSpan
+{
+ public:
+  TokenValueSpan() = default;
+  TokenValueSpan(const std::string_view* values, std::size_t count)
+      : itsData(values), itsSize(count)
+  {
+  }
+
+  TokenValueSpan(const std::vector<std::string_view>& values)
+      : itsData(values.data()), itsSize(values.size())
+  {
+  }
+
+  template <std::size_t N>
+  TokenValueSpan(const std::array<std::string_view, N>& values)
+      : itsData(values.data()), itsSize(N)
+  {
+  }
+
+  const std::string_view* begin() const { return itsData; }
+  const std::string_view* end() const { return itsData + itsSize; }
+  std::size_t size() const { return itsSize; }
+  bool empty() const { return itsSize == 0; }
+  const std::string_view& operator[](std::size_t i) const { return itsData[i]; }
+
+ private:
+  const std::string_view* itsData = nullptr;
+  std::size_t itsSize = 0;
+};
+
+// One check of a batch, the views must stay valid during the call
+struct AuthorizationRequest
+{
+  std::string_view apikey;
+  std::string_view service;
+  std::string_view tokenvalue;
+  bool explicitGrantOnly = false;
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Location of a name in the active authorization data
+ *
+ * The engine caches the result of the name lookup in the handle together
+ * with the generation of the data it was found in. When the data is
+ * updated, the name is looked up again on first use, hence handles stay
+ * valid for as long as the caller keeps them.
+ */
+// ----------------------------------------------------------------------
+
+class ResolvedName
+{
+ public:
+  ResolvedName() = default;
+  explicit ResolvedName(std::string name) : itsName(std::move(name)) {}
+
+  ResolvedName(const ResolvedName& other) : itsName(other.itsName), itsCache(other.cache()) {}
+
+  ResolvedName& operator=(const ResolvedName& other)
+  {
+    if (this != &other)
+    {
+      itsName = other.itsName;
+      setCache(other.cache());
+    }
+    return *this;
+  }
+
+  const std::string& name() const { return itsName; }
+
+  // For the engine implementation only: generation in the high and id in the low 32 bits
+  std::uint64_t cache() const { return itsCache.load(std::memory_order_relaxed); }
+  void setCache(std::uint64_t value) const { itsCache.store(value, std::memory_order_relaxed); }
+
+ private:
+  std::string itsName;
+  mutable std::atomic<std::uint64_t> itsCache{0};
+};
+
+// Service resolved once, typically when a plugin is initialized
+class ServiceHandle : public ResolvedName
+{
+ public:
+  using ResolvedName::ResolvedName;
+};
+
+// Apikey resolved for a service, typically once per request. A default constructed handle has
+// no service, and authorizing with it fails.
+class ApikeyHandle : public ResolvedName
+{
+ public:
+  ApikeyHandle() = default;
+  ApikeyHandle(ServiceHandle service, std::string apikey)
+      : ResolvedName(std::move(apikey)), itsService(std::move(service)), itsHasService(true)
+  {
+  }
+
+  bool hasService() const { return itsHasService; }
+  const ServiceHandle& service() const { return itsService; }
+
+ private:
+  ServiceHandle itsService;
+  bool itsHasService = false;
+};
+
+// Outcomes of the checks of the values of a service, by the status the check resolved to
+struct ServiceMetrics
+{
+  std::string service;
+  std::uint64_t grant = 0;
+  std::uint64_t wildcardGrant = 0;
+  std::uint64_t deny = 0;
+  std::uint64_t unknownApikey = 0;
+};
+
+// Timings and sizes of the latest update of the authorization data
+struct RebuildMetrics
+{
+  std::string kind;  // "full", "changelog" or "expiry", empty if there has been none
+  double probeSeconds = 0;  // change detection
+  double querySeconds = 0;  // reading the rows, excluding building
+  double buildSeconds = 0;  // building the indexes
+  double swapSeconds = 0;   // taking the new data into use
+  std::size_t rows = 0;
+  std::size_t services = 0;
+  std::size_t apikeys = 0;
+  std::size_t snapshotBytes = 0;
+
+  // Of all update rounds, including the ones which found no changes. Epoch seconds, zero
+  // if there has been none.
+  std::int64_t lastSuccess = 0;
+  std::int64_t lastFailure = 0;
+  std::string lastError;
+  std::uint64_t successes = 0;
+  std::uint64_t failures = 0;
+};
+
+// Rows of the token and authorization tables, for engines serving data given by the process
+struct TokenRow
+{
+  std::string service;
+  std::string token;
+  std::string value;
+};
+
+struct GrantRow
+{
+  std::string apikey;
+  std::string service;
+  std::string token;
+  std::int64_t validUntil = std::numeric_limits<std::int64_t>::max();  // epoch seconds
+};
+
+// Counters since the engine was started, for status queries
+struct EngineMetrics
+{
+  // Whether the authorization calls are counted and timed at all
+  bool enabled = false;
+
+  std::vector<ServiceMetrics> services;
+  std::uint64_t unknownService = 0;
+
+  // Element i counts calls which took less than 2^i but at least 2^(i-1) nanoseconds
+  std::vector<std::uint64_t> latencyHistogram;
+
+  RebuildMetrics rebuild;
+};
+
 class Engine : public SmartMet::Spine::SmartMetEngine
 {
   // NOTICE: entire implementation of this base class must be located in the header file
@@ -40,10 +218,23 @@ class Engine : public SmartMet::Spine::SmartMetEngine
     throw Fmi::Exception(BCP, "Not implemented");
   }
 
-  // Authorize a single value for given service
-  virtual bool authorize(const std::string& apikey,
-                         const std::string& tokenvalue,
-                         const std::string& service,
+  // Same without copying the values into strings. The check itself allocates no memory.
+  virtual bool authorize(std::string_view apikey,
+                         TokenValueSpan tokenvalues,
+                         std::string_view service) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    (void)service;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  // Authorize a single value for given service. Strings and string literals convert to views.
+  // Replaces the overload taking std::string references, which would make calls with string
+  // literals ambiguous.
+  virtual bool authorize(std::string_view apikey,
+                         std::string_view tokenvalue,
+                         std::string_view service,
                          bool explicitGrantOnly = false) const
   {
     (void)apikey;
@@ -53,6 +244,135 @@ class Engine : public SmartMet::Spine::SmartMetEngine
     throw Fmi::Exception(BCP, "Not implemented");
   }
 
+  // Verdict for each value separately, the service and the apikey are looked up only once.
+  // Element i is true if the single value authorize would allow tokenvalues[i].
+  virtual std::vector<bool> authorizeEach(std::string_view apikey,
+                                          const std::vector<std::string>& tokenvalues,
+                                          std::string_view service) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    (void)service;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  virtual std::vector<bool> authorizeEach(std::string_view apikey,
+                                          TokenValueSpan tokenvalues,
+                                          std::string_view service) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    (void)service;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  // Evaluate many single value checks against the same data. Element i is the result of the
+  // single value authorize for requests[i].
+  virtual std::vector<bool> authorizeBatch(const std::vector<AuthorizationRequest>& requests) const
+  {
+    (void)requests;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  // Spend one request from the quota of the apikey for the service. Returns false if the quota
+  // is exhausted and the request should be refused. Apikeys without a quota are not limited.
+  virtual bool consume(std::string_view apikey, std::string_view service) const
+  {
+    (void)apikey;
+    (void)service;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  // Replace the authorization data when the engine is configured with the in-memory source.
+  // The data is taken into use on the next update round.
+  virtual void setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants)
+  {
+    (void)tokens;
+    (void)grants;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  // Counters and timings for status queries
+  virtual EngineMetrics metrics() const
+  {
+    return EngineMetrics();  // A disabled engine does nothing worth measuring
+  }
+
+  // Called after new authorization data has been taken into use, with its generation
+  using ChangeCallback = std::function<void(std::uint64_t generation)>;
+
+  // Number of the active authorization data. It increases whenever new data is taken into use,
+  // hence it can be used to invalidate results derived from earlier data.
+  virtual std::uint64_t generation() const
+  {
+    return 0;  // The data of a disabled engine never changes
+  }
+
+  // Register a callback for data changes. The callback is run on the update thread and must not
+  // block. Returns an id for unsubscribe.
+  virtual std::size_t subscribe(ChangeCallback callback)
+  {
+    (void)callback;
+    return 0;  // The data of a disabled engine never changes
+  }
+
+  // Remove a callback. A notification already in progress may still call it once.
+  virtual void unsubscribe(std::size_t id) { (void)id; }
+
+  // Resolve a service for authorizing values with apikey handles
+  virtual ServiceHandle resolveService(const std::string& service) const
+  {
+    return ServiceHandle(service);
+  }
+
+  // Resolve an apikey for a service handle
+  virtual ApikeyHandle resolveApikey(const ServiceHandle& service, const std::string& apikey) const
+  {
+    return ApikeyHandle(service, apikey);
+  }
+
+  // Same as the corresponding authorize overloads taking names
+  virtual bool authorize(const ApikeyHandle& apikey,
+                         const std::vector<std::string>& tokenvalues) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  virtual bool authorize(const ApikeyHandle& apikey, TokenValueSpan tokenvalues) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  virtual bool authorize(const ApikeyHandle& apikey,
+                         std::string_view tokenvalue,
+                         bool explicitGrantOnly = false) const
+  {
+    (void)apikey;
+    (void)tokenvalue;
+    (void)explicitGrantOnly;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  virtual std::vector<bool> authorizeEach(const ApikeyHandle& apikey,
+                                          const std::vector<std::string>& tokenvalues) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
+  virtual std::vector<bool> authorizeEach(const ApikeyHandle& apikey,
+                                          TokenValueSpan tokenvalues) const
+  {
+    (void)apikey;
+    (void)tokenvalues;
+    throw Fmi::Exception(BCP, "Not implemented");
+  }
+
  protected:
   void init() override {}
   void shutdown() override {}
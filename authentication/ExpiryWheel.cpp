@@ -0,0 +1,72 @@
+#include "ExpiryWheel.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <iterator>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+ExpiryWheel::ExpiryWheel(std::size_t slots) : itsSlots(std::max<std::size_t>(slots, 1)) {}
+
+void ExpiryWheel::reset(std::int64_t now)
+{
+  for (auto& slot : itsSlots)
+    slot.clear();
+  itsTime = now;
+  itsSize = 0;
+}
+
+void ExpiryWheel::add(Entry entry)
+{
+  try
+  {
+    // Slots up to the current second have already been inspected
+    const auto time = std::max(entry.time, itsTime + 1);
+    const auto nslots = static_cast<std::int64_t>(itsSlots.size());
+    itsSlots[static_cast<std::size_t>(((time % nslots) + nslots) % nslots)].push_back(
+        std::move(entry));
+    itsSize++;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::vector<ExpiryWheel::Entry> ExpiryWheel::advance(std::int64_t now)
+{
+  try
+  {
+    std::vector<Entry> ret;
+    if (now <= itsTime)
+      return ret;
+
+    // After a long pause every slot is inspected just once
+    const auto nslots = static_cast<std::int64_t>(itsSlots.size());
+    const auto steps = std::min(now - itsTime, nslots);
+    for (std::int64_t i = 1; i <= steps; i++)
+    {
+      const auto time = itsTime + i;
+      auto& slot = itsSlots[static_cast<std::size_t>(((time % nslots) + nslots) % nslots)];
+      auto due = std::partition(
+          slot.begin(), slot.end(), [now](const Entry& entry) { return entry.time > now; });
+      std::move(due, slot.end(), std::back_inserter(ret));
+      slot.erase(due, slot.end());
+    }
+
+    itsTime = now;
+    itsSize -= ret.size();
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Timer wheel of grant expiry times with a resolution of one second
+ *
+ * Each slot holds the grants expiring at the seconds which map to it, so
+ * advancing the wheel by one second inspects a single slot regardless of
+ * the number of grants scheduled. Grants further away than one turn of
+ * the wheel simply stay in their slot until their turn comes.
+ *
+ * Entries are never cancelled. The caller checks that a due grant still
+ * has the same expiry time before removing it.
+ */
+// ----------------------------------------------------------------------
+
+class ExpiryWheel
+{
+ public:
+  struct Entry
+  {
+    std::int64_t time;  // epoch seconds
+    std::string service;
+    std::string apikey;
+    std::string token;
+  };
+
+  explicit ExpiryWheel(std::size_t slots = 4096);
+
+  // Remove all entries, the wheel is next advanced from the given time
+  void reset(std::int64_t now);
+
+  // Entries already due are returned by the next advance()
+  void add(Entry entry);
+
+  // Remove and return the entries due by the given time
+  std::vector<Entry> advance(std::int64_t now);
+
+  std::size_t size() const { return itsSize; }
+
+ private:
+  std::vector<std::vector<Entry>> itsSlots;
+  std::int64_t itsTime = 0;  // the last second advanced to
+  std::size_t itsSize = 0;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,179 @@
+#include "FileSource.h"
+#include <macgyver/Exception.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <fstream>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+// Split a CSV line into fields, false if the line has no data
+bool splitLine(const std::string& line, std::vector<std::string>& fields)
+{
+  fields.clear();
+  if (line.empty() || line[0] == '#' || line == "\r")
+    return false;
+
+  std::string field;
+  bool quoted = false;
+  for (std::size_t i = 0; i < line.size(); i++)
+  {
+    const char ch = line[i];
+    if (quoted)
+    {
+      if (ch != '"')
+        field += ch;
+      else if (i + 1 < line.size() && line[i + 1] == '"')
+        field += line[++i];
+      else
+        quoted = false;
+    }
+    else if (ch == '"')
+      quoted = true;
+    else if (ch == ',')
+    {
+      fields.push_back(field);
+      field.clear();
+    }
+    else if (ch != '\r')
+      field += ch;
+  }
+  if (quoted)
+    throw Fmi::Exception(BCP, "Unterminated quoted field");
+  fields.push_back(field);
+  return true;
+}
+
+// Call the function with the fields of each data line of the file
+template <typename Function>
+void readFile(const std::string& filename,
+              std::size_t minFields,
+              std::size_t maxFields,
+              Function&& function)
+{
+  std::ifstream in(filename);
+  if (!in)
+    throw Fmi::Exception(BCP, "Failed to open file").addParameter("File", filename);
+
+  std::string line;
+  std::vector<std::string> fields;
+  std::size_t lineNumber = 0;
+  try
+  {
+    while (std::getline(in, line))
+    {
+      lineNumber++;
+      if (!splitLine(line, fields))
+        continue;
+      if (fields.size() < minFields || fields.size() > maxFields)
+        throw Fmi::Exception(BCP, "Wrong number of fields");
+      function(fields);
+    }
+    if (in.bad())
+      throw Fmi::Exception(BCP, "Read error");
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Invalid file")
+        .addParameter("File", filename)
+        .addParameter("Line", std::to_string(lineNumber));
+  }
+}
+
+double toDouble(const std::string& str)
+{
+  char* end = nullptr;
+  const double value = std::strtod(str.c_str(), &end);
+  if (str.empty() || *end != '\0')
+    throw Fmi::Exception(BCP, "Invalid number").addParameter("Value", str);
+  return value;
+}
+
+std::int64_t toEpoch(const std::string& str)
+{
+  if (str.empty())
+    return NO_EXPIRY;
+  char* end = nullptr;
+  const long long value = std::strtoll(str.c_str(), &end, 10);
+  if (*end != '\0')
+    throw Fmi::Exception(BCP, "Invalid epoch time").addParameter("Value", str);
+  return value;
+}
+
+std::string fileVersion(const std::string& filename)
+{
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+    throw Fmi::Exception(BCP, "Failed to stat file").addParameter("File", filename);
+  return std::to_string(st.st_ino) + ':' + std::to_string(st.st_size) + ':' +
+         std::to_string(st.st_mtim.tv_sec) + '.' + std::to_string(st.st_mtim.tv_nsec) + ',';
+}
+
+}  // namespace
+
+FileSource::FileSource(std::string tokenFile, std::string grantFile, std::string quotaFile)
+    : itsTokenFile(std::move(tokenFile)),
+      itsGrantFile(std::move(grantFile)),
+      itsQuotaFile(std::move(quotaFile))
+{
+  if (itsTokenFile.empty() || itsGrantFile.empty())
+    throw Fmi::Exception(BCP, "The file source requires both a token and a grant file");
+}
+
+std::string FileSource::version()
+{
+  try
+  {
+    return fileVersion(itsTokenFile) + fileVersion(itsGrantFile);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void FileSource::load(RowSink& sink)
+{
+  try
+  {
+    readFile(itsTokenFile, 3, 3, [&sink](const std::vector<std::string>& fields) {
+      sink.tokenValue(fields[0], fields[1], fields[2]);
+    });
+    readFile(itsGrantFile, 3, 4, [&sink](const std::vector<std::string>& fields) {
+      const auto validUntil = (fields.size() > 3 ? toEpoch(fields[3]) : NO_EXPIRY);
+      sink.grant(fields[0], fields[1], fields[2], validUntil);
+    });
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool FileSource::quotas(QuotaData& quotas)
+{
+  try
+  {
+    if (itsQuotaFile.empty())
+      return false;
+
+    readFile(itsQuotaFile, 4, 4, [&quotas](const std::vector<std::string>& fields) {
+      quotas[std::make_pair(fields[1], fields[0])] =
+          QuotaLimit{toDouble(fields[2]), toDouble(fields[3])};
+    });
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "DataSource.h"
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Data read from CSV exports of the tables on local disk
+ *
+ * The token file has rows of form service,token,value and the grant file
+ * rows of form apikey,service,token[,valid_until], where valid_until is in
+ * epoch seconds and empty if the grant never expires. The optional quota
+ * file has rows of form apikey,service,rate,burst. Fields may be quoted
+ * with double quotes, and empty lines and lines starting with # are
+ * ignored.
+ *
+ * The files are reloaded when their size, modification time or inode
+ * changes, hence they should be replaced by renaming a new file over them.
+ */
+// ----------------------------------------------------------------------
+
+class FileSource : public DataSource
+{
+ public:
+  FileSource(std::string tokenFile, std::string grantFile, std::string quotaFile);
+
+  std::string version() override;
+  void load(RowSink& sink) override;
+  bool quotas(QuotaData& quotas) override;
+
+ private:
+  std::string itsTokenFile;
+  std::string itsGrantFile;
+  std::string itsQuotaFile;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,206 @@
+#include "FlatImage.h"
+#include <algorithm>
+#include <cmath>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+// Finalizer of MurmurHash3
+std::uint64_t mix(std::uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDULL;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53ULL;
+  x ^= x >> 33;
+  return x;
+}
+
+std::uint32_t slotCount(std::size_t n)
+{
+  // Load factor is kept below one half to keep the probe sequences short
+  std::uint32_t count = 2;
+  while (count < 2 * n)
+    count *= 2;
+  return count;
+}
+
+}  // namespace
+
+std::uint64_t hashString(std::string_view str) noexcept
+{
+  const std::uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+  std::uint64_t hash = 0xCBF29CE484222325ULL ^ (str.size() * multiplier);
+
+  const char* ptr = str.data();
+  std::size_t n = str.size();
+  for (; n >= sizeof(std::uint64_t); ptr += sizeof(std::uint64_t), n -= sizeof(std::uint64_t))
+  {
+    std::uint64_t word;
+    std::memcpy(&word, ptr, sizeof(word));
+    hash = (hash ^ mix(word)) * multiplier;
+  }
+  if (n > 0)
+  {
+    std::uint64_t word = 0;
+    std::memcpy(&word, ptr, n);
+    hash = (hash ^ mix(word)) * multiplier;
+  }
+  return mix(hash);
+}
+
+StringTable::StringTable(const char* image, std::size_t imageSize, const Sections& sections)
+{
+  try
+  {
+    itsChars = imageArray<char>(image, imageSize, sections.chars);
+    itsOffsets = imageArray<std::uint32_t>(image, imageSize, sections.offsets);
+    itsSlots = imageArray<Slot>(image, imageSize, sections.slots);
+
+    // Validate the contents so that a damaged image cannot cause invalid memory accesses
+    if (itsOffsets.empty() || itsOffsets[0] != 0 || itsOffsets[size()] != itsChars.size())
+      throw Fmi::Exception(BCP, "Invalid string table offsets");
+    for (std::size_t i = 0; i < size(); i++)
+      if (itsOffsets[i] > itsOffsets[i + 1])
+        throw Fmi::Exception(BCP, "Invalid string table offsets");
+
+    if (itsSlots.size() < 2 || (itsSlots.size() & (itsSlots.size() - 1)) != 0)
+      throw Fmi::Exception(BCP, "Invalid string table size");
+    std::size_t used = 0;
+    for (const auto& slot : itsSlots)
+    {
+      if (slot.id == npos)
+        continue;
+      if (slot.id >= size())
+        throw Fmi::Exception(BCP, "Invalid string table slot");
+      ++used;
+    }
+    if (used != size() || used == itsSlots.size())
+      throw Fmi::Exception(BCP, "Invalid string table slot count");
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+StringTable::Sections StringTable::write(ImageWriter& writer,
+                                         const std::vector<std::string_view>& strings)
+{
+  try
+  {
+    std::vector<char> chars;
+    std::vector<std::uint32_t> offsets;
+    offsets.reserve(strings.size() + 1);
+    offsets.push_back(0);
+    for (const auto& str : strings)
+    {
+      chars.insert(chars.end(), str.begin(), str.end());
+      if (chars.size() >= npos)
+        throw Fmi::Exception(BCP, "String table too large");
+      offsets.push_back(static_cast<std::uint32_t>(chars.size()));
+    }
+
+    std::vector<Slot> slots(slotCount(strings.size()), Slot{0, npos});
+    const std::uint32_t mask = static_cast<std::uint32_t>(slots.size()) - 1;
+    for (std::uint32_t id = 0; id < strings.size(); id++)
+    {
+      const auto hash = hashString(strings[id]);
+      auto pos = static_cast<std::uint32_t>(hash) & mask;
+      while (slots[pos].id != npos)
+        pos = (pos + 1) & mask;
+      slots[pos] = Slot{static_cast<std::uint32_t>(hash >> 32), id};
+    }
+
+    Sections sections;
+    sections.chars = writer.append(chars);
+    sections.offsets = writer.append(offsets);
+    sections.slots = writer.append(slots);
+    return sections;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::uint32_t StringTable::find(std::string_view str, std::uint64_t hash) const noexcept
+{
+  if (itsSlots.empty())
+    return npos;
+
+  const auto tag = static_cast<std::uint32_t>(hash >> 32);
+  const std::uint32_t mask = static_cast<std::uint32_t>(itsSlots.size()) - 1;
+
+  for (auto pos = static_cast<std::uint32_t>(hash) & mask;; pos = (pos + 1) & mask)
+  {
+    const auto& slot = itsSlots[pos];
+    if (slot.id == npos)
+      return npos;
+    if (slot.hash == tag && at(slot.id) == str)
+      return slot.id;
+  }
+}
+
+BloomFilter::BloomFilter(const char* image,
+                         std::size_t imageSize,
+                         const ImageSection& words,
+                         std::uint32_t k)
+    : itsWords(imageArray<std::uint64_t>(image, imageSize, words)), itsK(k)
+{
+  if (itsWords.size() % BlockWords != 0 || itsWords.size() / BlockWords > 0xFFFFFFFFULL ||
+      (!itsWords.empty() && (k == 0 || k > 64)))
+    throw Fmi::Exception(BCP, "Invalid Bloom filter in image");
+}
+
+ImageSection BloomFilter::write(ImageWriter& writer,
+                                const std::vector<std::uint64_t>& hashes,
+                                double falsePositiveRate,
+                                std::uint32_t& k)
+{
+  try
+  {
+    k = 0;
+    if (hashes.empty() || !(falsePositiveRate > 0) || falsePositiveRate >= 1)
+      return writer.append(static_cast<const std::uint64_t*>(nullptr), 0);
+
+    // Optimal sizing for a standard filter. Blocking raises the actual rate a little, one extra
+    // bit per key compensates for most of it.
+    const double ln2 = std::log(2.0);
+    const double bitsPerKey = -std::log(falsePositiveRate) / (ln2 * ln2) + 1;
+    k = std::min<std::uint32_t>(
+        std::max<std::uint32_t>(static_cast<std::uint32_t>(std::lround(bitsPerKey * ln2)), 1), 16);
+
+    const std::size_t blockBits = BlockWords * 64;
+    const auto nbits = static_cast<std::size_t>(std::ceil(hashes.size() * bitsPerKey));
+    const std::size_t nblocks = std::max<std::size_t>((nbits + blockBits - 1) / blockBits, 1);
+    if (nblocks > 0xFFFFFFFFULL)
+      throw Fmi::Exception(BCP, "Bloom filter too large");
+
+    std::vector<std::uint64_t> words(nblocks * BlockWords, 0);
+    for (const auto hash : hashes)
+    {
+      auto* block = blockOf(hash, nblocks, words.data());
+      auto state = hash;
+      for (std::uint32_t i = 0; i < k; i++)
+      {
+        const auto pos = nextPosition(state);
+        block[pos / 64] |= (std::uint64_t(1) << (pos % 64));
+      }
+    }
+    return writer.append(words);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
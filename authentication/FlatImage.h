@@ -0,0 +1,256 @@
+#pragma once
+
+#include <macgyver/Exception.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// Location of an array inside a flat image. Offsets are relative to the start of the image,
+// hence images are position independent and contain no pointers.
+struct ImageSection
+{
+  std::uint64_t offset = 0;
+  std::uint64_t count = 0;
+};
+
+// Range of elements in a pool array of an image
+struct PoolRange
+{
+  std::uint32_t offset = 0;
+  std::uint32_t count = 0;
+};
+
+// Read-only view to an array stored in an image
+template <typename T>
+class ArrayView
+{
+ public:
+  ArrayView() = default;
+  ArrayView(const T* data, std::size_t size) : itsData(data), itsSize(size) {}
+
+  const T* begin() const { return itsData; }
+  const T* end() const { return itsData + itsSize; }
+  const T* data() const { return itsData; }
+  std::size_t size() const { return itsSize; }
+  bool empty() const { return itsSize == 0; }
+  const T& operator[](std::size_t i) const { return itsData[i]; }
+
+  ArrayView<T> slice(const PoolRange& range) const
+  {
+    return ArrayView<T>(itsData + range.offset, range.count);
+  }
+
+ private:
+  const T* itsData = nullptr;
+  std::size_t itsSize = 0;
+};
+
+// Images are stored as 64-bit words to keep all sections properly aligned
+using ImageBuffer = std::vector<std::uint64_t>;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Accumulates arrays into a flat image
+ *
+ * Room for a fixed size header is reserved at the start of the image,
+ * the header itself is written last once all section locations are known.
+ */
+// ----------------------------------------------------------------------
+
+class ImageWriter
+{
+ public:
+  explicit ImageWriter(std::size_t headerSize) { reserve(headerSize); }
+
+  template <typename T>
+  ImageSection append(const T* data, std::size_t count)
+  {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "Image contents must be trivially copyable");
+    ImageSection section;
+    section.offset = reserve(count * sizeof(T));
+    section.count = count;
+    if (count > 0)
+      std::memcpy(bytes() + section.offset, data, count * sizeof(T));
+    return section;
+  }
+
+  template <typename T>
+  ImageSection append(const std::vector<T>& data)
+  {
+    return append(data.data(), data.size());
+  }
+
+  template <typename T>
+  void writeHeader(const T& header)
+  {
+    static_assert(std::is_trivially_copyable<T>::value, "Image header must be trivially copyable");
+    std::memcpy(bytes(), &header, sizeof(T));
+  }
+
+  std::size_t size() const { return itsSize; }
+
+  std::shared_ptr<const ImageBuffer> release()
+  {
+    itsSize = 0;
+    return std::make_shared<const ImageBuffer>(std::move(itsBuffer));
+  }
+
+ private:
+  // Reserve aligned space for the given number of bytes, returning its offset
+  std::uint64_t reserve(std::size_t nbytes)
+  {
+    const std::uint64_t offset = itsSize;
+    itsSize += (nbytes + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t) * sizeof(std::uint64_t);
+    itsBuffer.resize(itsSize / sizeof(std::uint64_t), 0);
+    return offset;
+  }
+
+  char* bytes() { return reinterpret_cast<char*>(itsBuffer.data()); }
+
+  ImageBuffer itsBuffer;
+  std::size_t itsSize = 0;
+};
+
+// Validated view to a section of an image, throws if the section is out of bounds
+template <typename T>
+ArrayView<T> imageArray(const char* image, std::size_t imageSize, const ImageSection& section)
+{
+  if (section.offset % alignof(T) != 0 || section.offset > imageSize ||
+      section.count > (imageSize - section.offset) / sizeof(T))
+    throw Fmi::Exception(BCP, "Image section out of bounds");
+  return ArrayView<T>(reinterpret_cast<const T*>(image + section.offset), section.count);
+}
+
+// Stable hash function for image contents. Unlike std::hash the result must not depend on
+// the process, since images may be shared between processes.
+std::uint64_t hashString(std::string_view str) noexcept;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Interned strings with an open addressing hash index
+ *
+ * Each string is identified by a dense integer id, its position in the
+ * table. The characters are stored consecutively, and the hash slots
+ * contain the id plus part of the hash to avoid most string comparisons.
+ */
+// ----------------------------------------------------------------------
+
+class StringTable
+{
+ public:
+  static constexpr std::uint32_t npos = 0xFFFFFFFF;
+
+  struct Sections
+  {
+    ImageSection chars;
+    ImageSection offsets;
+    ImageSection slots;
+  };
+
+  StringTable() = default;
+  StringTable(const char* image, std::size_t imageSize, const Sections& sections);
+
+  // Append a table for the given strings, the ids will be the vector indexes
+  static Sections write(ImageWriter& writer, const std::vector<std::string_view>& strings);
+
+  std::uint32_t find(std::string_view str) const noexcept { return find(str, hashString(str)); }
+
+  // Same with a precomputed hashString(str)
+  std::uint32_t find(std::string_view str, std::uint64_t hash) const noexcept;
+
+  std::string_view at(std::uint32_t id) const noexcept
+  {
+    return std::string_view(itsChars.data() + itsOffsets[id], itsOffsets[id + 1] - itsOffsets[id]);
+  }
+
+  std::size_t size() const { return itsOffsets.empty() ? 0 : itsOffsets.size() - 1; }
+
+ private:
+  struct Slot
+  {
+    std::uint32_t hash;
+    std::uint32_t id;
+  };
+
+  ArrayView<char> itsChars;
+  ArrayView<std::uint32_t> itsOffsets;
+  ArrayView<Slot> itsSlots;
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Blocked Bloom filter of string hashes
+ *
+ * All the bits of a key are in a single 64 byte block, hence a lookup
+ * touches only one cache line. A negative answer is definite, a positive
+ * one is wrong roughly at the rate the filter was sized for. A filter
+ * without any blocks gives a positive answer for everything.
+ */
+// ----------------------------------------------------------------------
+
+class BloomFilter
+{
+ public:
+  static constexpr std::size_t BlockWords = 8;
+
+  BloomFilter() = default;
+  BloomFilter(const char* image, std::size_t imageSize, const ImageSection& words, std::uint32_t k);
+
+  // Append a filter of the given hashString values sized for the false positive rate. Returns
+  // the location of the filter, and the number of bits set per key in k. A zero rate disables
+  // the filter.
+  static ImageSection write(ImageWriter& writer,
+                            const std::vector<std::uint64_t>& hashes,
+                            double falsePositiveRate,
+                            std::uint32_t& k);
+
+  bool mayContain(std::uint64_t hash) const noexcept
+  {
+    if (itsWords.empty())
+      return true;
+
+    const auto* block = blockOf(hash, itsWords.size() / BlockWords, itsWords.data());
+    for (std::uint32_t i = 0; i < itsK; i++)
+    {
+      const auto pos = nextPosition(hash);
+      if ((block[pos / 64] & (std::uint64_t(1) << (pos % 64))) == 0)
+        return false;
+    }
+    return true;
+  }
+
+  std::size_t bytes() const { return itsWords.size() * sizeof(std::uint64_t); }
+
+ private:
+  template <typename Word>
+  static Word* blockOf(std::uint64_t hash, std::size_t nblocks, Word* words) noexcept
+  {
+    return words + BlockWords * static_cast<std::size_t>(((hash >> 32) * nblocks) >> 32);
+  }
+
+  // Bit positions inside a block from the top bits of successive LCG steps of the hash
+  static std::uint32_t nextPosition(std::uint64_t& state) noexcept
+  {
+    static_assert(BlockWords * 64 == 512, "Positions are 9 bits");
+    state = state * 0x5851f42d4c957f2dULL + 0x14057b7ef767814fULL;
+    return static_cast<std::uint32_t>(state >> 55);
+  }
+
+  ArrayView<std::uint64_t> itsWords;
+  std::uint32_t itsK = 0;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,42 @@
+#include "MemorySource.h"
+#include <macgyver/Exception.h>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+std::string MemorySource::version()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  return std::to_string(itsVersion);
+}
+
+void MemorySource::load(RowSink& sink)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    for (const auto& row : itsTokens)
+      sink.tokenValue(row.service, row.token, row.value);
+    for (const auto& row : itsGrants)
+      sink.grant(row.apikey, row.service, row.token, row.validUntil);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void MemorySource::setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants)
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsTokens = std::move(tokens);
+  itsGrants = std::move(grants);
+  itsVersion++;
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
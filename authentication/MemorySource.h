@@ -0,0 +1,37 @@
+#pragma once
+
+#include "DataSource.h"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Data given by the process itself, for tests and embedded use
+ */
+// ----------------------------------------------------------------------
+
+class MemorySource : public DataSource
+{
+ public:
+  std::string version() override;
+  void load(RowSink& sink) override;
+  void setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants) override;
+
+ private:
+  std::mutex itsMutex;
+  std::vector<TokenRow> itsTokens;
+  std::vector<GrantRow> itsGrants;
+  std::uint64_t itsVersion = 0;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,268 @@
+#include "MergedSource.h"
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <iostream>
+#include <map>
+#include <set>
+#include <utility>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+MergedSource::MergedSource(const std::vector<SourceConfig>& sources, const IndexOptions& options)
+{
+  try
+  {
+    for (const auto& config : sources)
+    {
+      Member member;
+      member.reader = std::make_shared<Reader>();
+      member.reader->config = config;
+      member.reader->options = options;
+      member.reader->source = DataSource::create(config);
+      itsMembers.push_back(std::move(member));
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+MergedSource::~MergedSource()
+{
+  for (auto& member : itsMembers)
+    if (member.thread.joinable())
+      member.thread.join();
+}
+
+std::shared_ptr<const MergedSource::Data> MergedSource::read(Reader& reader,
+                                                             std::shared_ptr<const Data> previous)
+{
+  auto& source = *reader.source;
+  const auto& prefix = reader.config.prefix;
+
+  source.begin();
+  try
+  {
+    auto data = std::make_shared<Data>();
+
+    QuotaData quotas;
+    data->hasQuotas = source.quotas(quotas);
+    for (auto& quota : quotas)
+      data->quotas[std::make_pair(prefix + quota.first.first, quota.first.second)] = quota.second;
+
+    std::string version;
+    bool loaded = false;
+    std::vector<RowChange> changes;
+    if (previous && source.changes(changes))
+    {
+      if (changes.empty())
+        data->snapshot = previous->snapshot;
+      else
+      {
+        // Copy-on-write, as with a single source
+        SnapshotBuilder builder(*previous->snapshot, reader.options);
+        for (auto& change : changes)
+        {
+          change.service.insert(0, prefix);
+          applyChange(builder, change);
+        }
+        data->snapshot = builder.build();
+      }
+    }
+    else
+    {
+      version = source.version();
+      if (previous && !version.empty() && version == reader.version)
+        data->snapshot = previous->snapshot;
+      else
+      {
+        IndexSink sink(reader.options, prefix);
+        source.load(sink);
+        data->snapshot = sink.build();
+        loaded = true;
+      }
+    }
+
+    source.end(true);
+    if (loaded)
+      reader.version = version;
+    return data;
+  }
+  catch (...)
+  {
+    source.end(false);
+    throw Fmi::Exception::Trace(BCP, "Operation failed!")
+        .addParameter("Source", reader.config.name);
+  }
+}
+
+void MergedSource::begin()
+{
+  try
+  {
+    // Reads which timed out on earlier rounds are still running and are not restarted
+    const auto start = std::chrono::steady_clock::now();
+    for (auto& member : itsMembers)
+      if (!member.task)
+      {
+        auto task = std::make_shared<Task>();
+        member.thread = std::thread([reader = member.reader, task, previous = member.data]() {
+          std::shared_ptr<const Data> data;
+          std::exception_ptr error;
+          try
+          {
+            data = read(*reader, previous);
+          }
+          catch (...)
+          {
+            error = std::current_exception();
+          }
+          std::lock_guard<std::mutex> lock(task->mutex);
+          task->data = std::move(data);
+          task->error = error;
+          task->done = true;
+          task->finished.notify_all();
+        });
+        member.task = std::move(task);
+      }
+
+    std::size_t available = 0;
+    for (auto& member : itsMembers)
+    {
+      const auto& config = member.reader->config;
+      const auto deadline = start + std::chrono::seconds(config.timeoutSeconds);
+      std::shared_ptr<const Data> data;
+      std::exception_ptr error;
+      bool done = false;
+      {
+        auto& task = *member.task;
+        std::unique_lock<std::mutex> lock(task.mutex);
+        done = task.finished.wait_until(lock, deadline, [&task]() { return task.done; });
+        data = std::move(task.data);
+        error = task.error;
+      }
+
+      if (!done)
+      {
+        std::cout << Spine::log_time_str() << " Authentication engine: source " << config.name
+                  << " did not respond within " << config.timeoutSeconds
+                  << " seconds, using its previous data\n";
+      }
+      else
+      {
+        member.thread.join();
+        member.task.reset();
+        try
+        {
+          if (error)
+            std::rethrow_exception(error);
+          if (!member.data || data->snapshot != member.data->snapshot)
+            itsGeneration++;
+          member.data = std::move(data);
+        }
+        catch (...)
+        {
+          Fmi::Exception exception(BCP, "Failed to read source, using its previous data", nullptr);
+          exception.addParameter("Source", config.name);
+          exception.printError();
+        }
+      }
+
+      if (member.data)
+        available++;
+    }
+
+    if (available == 0)
+      throw Fmi::Exception(BCP, "None of the sources could be read");
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::string MergedSource::version()
+{
+  return std::to_string(itsGeneration);
+}
+
+void MergedSource::load(RowSink& sink)
+{
+  try
+  {
+    // The first source granting something in a service takes precedence. A service with token
+    // values only is used only if no source grants anything in it.
+    std::set<std::string> names;
+    std::map<std::string, std::shared_ptr<const ServiceIndex>> undefined;
+    for (const auto& member : itsMembers)
+    {
+      if (!member.data)
+        continue;
+      for (const auto& service : member.data->snapshot->services())
+      {
+        std::string name(service->name());
+        if (!service->isDefined())
+          undefined.emplace(std::move(name), service);
+        else if (names.insert(std::move(name)).second)
+          sink.service(service);
+      }
+    }
+    for (const auto& service : undefined)
+      if (names.count(service.first) == 0)
+        sink.service(service.second);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool MergedSource::quotas(QuotaData& quotas)
+{
+  try
+  {
+    bool found = false;
+    for (const auto& member : itsMembers)
+    {
+      if (!member.data || !member.data->hasQuotas)
+        continue;
+      found = true;
+      // Existing limits are not replaced, hence the first source takes precedence
+      quotas.insert(member.data->quotas.begin(), member.data->quotas.end());
+    }
+    return found;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void MergedSource::setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants)
+{
+  try
+  {
+    for (auto& member : itsMembers)
+    {
+      if (member.reader->config.type == "memory")
+      {
+        member.reader->source->setData(std::move(tokens), std::move(grants));
+        return;
+      }
+    }
+    throw Fmi::Exception(BCP, "None of the data sources accepts data from the process");
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
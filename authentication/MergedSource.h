@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Config.h"
+#include "DataSource.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Data merged from several sources
+ *
+ * Each update round reads all the sources concurrently, each one in its
+ * own thread and with its own round. The service names of a source are
+ * prefixed with the prefix of the source, and a service defined by several
+ * sources is taken from the first source in the configuration which grants
+ * something in it. Token values without any grants do not hide the grants
+ * of a later source.
+ *
+ * A source which fails keeps its previous data. A source which does not
+ * finish within its timeout also keeps its previous data, and the next
+ * round waits for the same read to finish instead of starting a new one.
+ * The destruction of the merged source waits for the reads in progress,
+ * since the reading threads run the code of the sources.
+ */
+// ----------------------------------------------------------------------
+
+class MergedSource : public DataSource
+{
+ public:
+  MergedSource(const std::vector<SourceConfig>& sources, const IndexOptions& options);
+  ~MergedSource() override;
+
+  MergedSource(const MergedSource& other) = delete;
+  MergedSource& operator=(const MergedSource& other) = delete;
+  MergedSource(MergedSource&& other) = delete;
+  MergedSource& operator=(MergedSource&& other) = delete;
+
+  // Reads the sources
+  void begin() override;
+
+  std::string version() override;
+  void load(RowSink& sink) override;
+  bool quotas(QuotaData& quotas) override;
+
+  // Passed to the first in-memory source
+  void setData(std::vector<TokenRow> tokens, std::vector<GrantRow> grants) override;
+
+ private:
+  // Data of a source from its latest successful round
+  struct Data
+  {
+    std::shared_ptr<const Snapshot> snapshot;
+    QuotaData quotas;
+    bool hasQuotas = false;
+  };
+
+  // Everything a read uses, shared with the reading thread
+  struct Reader
+  {
+    SourceConfig config;
+    IndexOptions options;
+    std::unique_ptr<DataSource> source;
+    std::string version;  // of the data last loaded, used only by the reading thread
+  };
+
+  // Result of a read, shared with the reading thread
+  struct Task
+  {
+    std::mutex mutex;
+    std::condition_variable finished;
+    bool done = false;
+    std::shared_ptr<const Data> data;
+    std::exception_ptr error;
+  };
+
+  struct Member
+  {
+    std::shared_ptr<Reader> reader;
+    std::shared_ptr<const Data> data;  // nullptr until the source has been read
+    std::shared_ptr<Task> task;        // read in progress, nullptr if none
+    std::thread thread;                // of the read in progress
+  };
+
+  // Read the source, returns the new data of the source
+  static std::shared_ptr<const Data> read(Reader& reader, std::shared_ptr<const Data> previous);
+
+  std::vector<Member> itsMembers;
+
+  // Incremented whenever the data of any source changes
+  std::uint64_t itsGeneration = 0;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,315 @@
+#include "Metrics.h"
+#include <macgyver/Exception.h>
+#include <array>
+#include <atomic>
+#include <ctime>
+#include <map>
+#include <set>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+// Services counted separately by each thread, the rest are counted together
+constexpr std::size_t SlotCount = 256;
+const char* const OTHER_SERVICES = "*other*";
+
+using Counts = std::array<std::uint64_t, Metrics::OutcomeCount>;
+
+struct Slot
+{
+  std::atomic<std::uint64_t> key{0};  // service hash with the lowest bit set, zero if free
+  std::atomic<std::uint64_t> counts[Metrics::OutcomeCount] = {{0}, {0}, {0}, {0}, {0}};
+};
+
+// Counters of a single thread. The counters are written only by the owning thread, they are
+// atomic only so that report() may read them.
+struct ThreadTable
+{
+  ThreadTable()
+  {
+    for (auto& counter : latency)
+      counter.store(0, std::memory_order_relaxed);
+  }
+
+  Slot slots[SlotCount];
+  Slot other;
+  std::atomic<std::uint64_t> unknownService{0};
+  std::atomic<std::uint64_t> latency[Metrics::LatencyBuckets];
+};
+
+// Tables of all live threads, the counts of threads which have exited, and the service names
+struct Registry
+{
+  std::mutex mutex;
+  std::set<const ThreadTable*> tables;
+  std::map<std::uint64_t, std::string> names;
+  std::map<std::uint64_t, Counts> retired;
+  Counts retiredOther{};
+  std::uint64_t retiredUnknownService = 0;
+  std::array<std::uint64_t, Metrics::LatencyBuckets> retiredLatency{};
+};
+
+// Never destroyed, threads may exit after static destructors have been run
+Registry& registry()
+{
+  static auto* instance = new Registry;
+  return *instance;
+}
+
+// Add the counters of a table to the totals, the registry must be locked
+void collect(const ThreadTable& table,
+             std::map<std::uint64_t, Counts>& counts,
+             Counts& other,
+             std::uint64_t& unknownService,
+             std::array<std::uint64_t, Metrics::LatencyBuckets>& latency)
+{
+  for (const auto& slot : table.slots)
+  {
+    const auto key = slot.key.load(std::memory_order_acquire);
+    if (key == 0)
+      continue;
+    auto& total = counts[key];
+    for (std::size_t i = 0; i < Metrics::OutcomeCount; i++)
+      total[i] += slot.counts[i].load(std::memory_order_relaxed);
+  }
+  for (std::size_t i = 0; i < Metrics::OutcomeCount; i++)
+    other[i] += table.other.counts[i].load(std::memory_order_relaxed);
+  unknownService += table.unknownService.load(std::memory_order_relaxed);
+  for (std::size_t i = 0; i < Metrics::LatencyBuckets; i++)
+    latency[i] += table.latency[i].load(std::memory_order_relaxed);
+}
+
+class ThreadTableHolder
+{
+ public:
+  ThreadTableHolder()
+  {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.tables.insert(&table);
+  }
+
+  ~ThreadTableHolder()
+  {
+    auto& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    collect(table, reg.retired, reg.retiredOther, reg.retiredUnknownService, reg.retiredLatency);
+    reg.tables.erase(&table);
+  }
+
+  ThreadTableHolder(const ThreadTableHolder& other) = delete;
+  ThreadTableHolder& operator=(const ThreadTableHolder& other) = delete;
+  ThreadTableHolder(ThreadTableHolder&& other) = delete;
+  ThreadTableHolder& operator=(ThreadTableHolder&& other) = delete;
+
+  ThreadTable table;
+};
+
+ThreadTable& threadTable()
+{
+  thread_local ThreadTableHolder holder;
+  return holder.table;
+}
+
+inline void add(std::atomic<std::uint64_t>& counter, std::uint64_t n) noexcept
+{
+  counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+}  // namespace
+
+void Metrics::count(std::string_view service, std::size_t outcome, std::uint64_t n) const
+{
+  try
+  {
+    auto& table = threadTable();
+    if (outcome == UNKNOWN_SERVICE)
+    {
+      add(table.unknownService, n);
+      return;
+    }
+
+    const auto key = hashString(service) | 1U;
+    for (std::size_t probe = 0; probe < SlotCount; probe++)
+    {
+      auto& slot = table.slots[((key >> 32) + probe) % SlotCount];
+      const auto slotKey = slot.key.load(std::memory_order_relaxed);
+      if (slotKey == 0)
+      {
+        // First use of the service by this thread
+        {
+          auto& reg = registry();
+          std::lock_guard<std::mutex> lock(reg.mutex);
+          reg.names.emplace(key, std::string(service));
+        }
+        slot.key.store(key, std::memory_order_release);
+      }
+      else if (slotKey != key)
+        continue;
+
+      add(slot.counts[outcome], n);
+      return;
+    }
+
+    add(table.other.counts[outcome], n);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Metrics::latency(std::int64_t start) const
+{
+  const auto elapsed = now() - start;
+  std::size_t bucket = 0;
+  if (elapsed > 0)
+    bucket = std::min<std::size_t>(
+        64 - static_cast<std::size_t>(__builtin_clzll(static_cast<std::uint64_t>(elapsed))),
+        LatencyBuckets - 1);
+  add(threadTable().latency[bucket], 1);
+}
+
+void Metrics::rebuilt(const RebuildMetrics& rebuild)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    auto result = rebuild;
+    result.lastSuccess = itsRebuild.lastSuccess;
+    result.lastFailure = itsRebuild.lastFailure;
+    result.lastError = itsRebuild.lastError;
+    result.successes = itsRebuild.successes;
+    result.failures = itsRebuild.failures;
+    itsRebuild = result;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void Metrics::succeeded()
+{
+  std::lock_guard<std::mutex> lock(itsMutex);
+  itsRebuild.lastSuccess = static_cast<std::int64_t>(std::time(nullptr));
+  itsRebuild.successes++;
+}
+
+void Metrics::failed(const std::string& error)
+{
+  try
+  {
+    std::lock_guard<std::mutex> lock(itsMutex);
+    itsRebuild.lastFailure = static_cast<std::int64_t>(std::time(nullptr));
+    itsRebuild.lastError = error;
+    itsRebuild.failures++;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+EngineMetrics Metrics::report(bool enabled) const
+{
+  try
+  {
+    EngineMetrics ret;
+    ret.enabled = enabled;
+
+    std::map<std::uint64_t, Counts> counts;
+    Counts other{};
+    std::array<std::uint64_t, LatencyBuckets> latency{};
+    std::map<std::uint64_t, std::string> names;
+    {
+      auto& reg = registry();
+      std::lock_guard<std::mutex> lock(reg.mutex);
+      counts = reg.retired;
+      other = reg.retiredOther;
+      ret.unknownService = reg.retiredUnknownService;
+      latency = reg.retiredLatency;
+      for (const auto* table : reg.tables)
+        collect(*table, counts, other, ret.unknownService, latency);
+      names = reg.names;
+    }
+
+    auto serviceMetrics = [](std::string name, const Counts& total) {
+      ServiceMetrics metrics;
+      metrics.service = std::move(name);
+      metrics.grant = total[outcome(AccessStatus::GRANT)];
+      metrics.wildcardGrant = total[outcome(AccessStatus::WILDCARD_GRANT)];
+      metrics.deny = total[outcome(AccessStatus::DENY)];
+      metrics.unknownApikey = total[outcome(AccessStatus::UNKNOWN_APIKEY)];
+      return metrics;
+    };
+
+    for (const auto& service : counts)
+      ret.services.push_back(serviceMetrics(names[service.first], service.second));
+    if (other != Counts{})
+      ret.services.push_back(serviceMetrics(OTHER_SERVICES, other));
+
+    ret.latencyHistogram.assign(latency.begin(), latency.end());
+
+    std::lock_guard<std::mutex> lock(itsMutex);
+    ret.rebuild = itsRebuild;
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::string Metrics::summary(const EngineMetrics& metrics)
+{
+  try
+  {
+    ServiceMetrics total;
+    for (const auto& service : metrics.services)
+    {
+      total.grant += service.grant;
+      total.wildcardGrant += service.wildcardGrant;
+      total.deny += service.deny;
+      total.unknownApikey += service.unknownApikey;
+    }
+    const auto checks = total.grant + total.wildcardGrant + total.deny + total.unknownApikey +
+                        metrics.unknownService;
+
+    std::string ret = std::to_string(checks) + " checks, " + std::to_string(total.grant) +
+                      " granted, " + std::to_string(total.wildcardGrant) +
+                      " granted by wildcard, " + std::to_string(total.deny) + " denied, " +
+                      std::to_string(total.unknownApikey) + " unknown apikeys, " +
+                      std::to_string(metrics.unknownService) + " unknown services";
+
+    // Upper bound of the 99th percentile of the call latencies
+    std::uint64_t calls = 0;
+    for (const auto count : metrics.latencyHistogram)
+      calls += count;
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; calls > 0 && i < metrics.latencyHistogram.size(); i++)
+    {
+      sum += metrics.latencyHistogram[i];
+      if (sum * 100 >= calls * 99)
+      {
+        ret += ", 99% of " + std::to_string(calls) + " calls took under " +
+               std::to_string(std::uint64_t(1) << i) + " ns";
+        break;
+      }
+    }
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
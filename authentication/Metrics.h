@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Engine.h"
+#include "ServiceIndex.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Counters of authorization outcomes and latencies, plus update statistics
+ *
+ * Each thread counts into tables of its own, hence counting needs no
+ * synchronization, and the tables are summed up only when the metrics
+ * are queried. Services are found in the table of a thread by hash, and
+ * their names are registered centrally on first use only.
+ *
+ * The engine calls the counting functions only when metrics are enabled,
+ * so that disabled metrics cost a single branch.
+ */
+// ----------------------------------------------------------------------
+
+class Metrics
+{
+ public:
+  // Outcome of a check of a value of an unknown service, the others are the AccessStatus values
+  static constexpr std::size_t UNKNOWN_SERVICE = 4;
+  static constexpr std::size_t OutcomeCount = 5;
+
+  static constexpr std::size_t LatencyBuckets = 40;
+
+  static std::size_t outcome(AccessStatus status) { return static_cast<std::size_t>(status); }
+
+  // Start time of a call for latency()
+  static std::int64_t now() noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  // Count the outcomes of checks of the service
+  void count(std::string_view service, std::size_t outcome, std::uint64_t n = 1) const;
+
+  // Record the latency of a call started at the given time
+  void latency(std::int64_t start) const;
+
+  // Update statistics, recorded by the update thread
+  void rebuilt(const RebuildMetrics& rebuild);
+  void succeeded();
+  void failed(const std::string& error);
+
+  // Totals over all threads of the process
+  EngineMetrics report(bool enabled) const;
+
+  // One line summary of the outcomes and latencies for the log
+  static std::string summary(const EngineMetrics& metrics);
+
+ private:
+  mutable std::mutex itsMutex;
+  RebuildMetrics itsRebuild;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
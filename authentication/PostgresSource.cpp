@@ -0,0 +1,616 @@
+#include "PostgresSource.h"
+#include <macgyver/Exception.h>
+#include <spine/Convenience.h>
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <utility>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Reads query results in batches through a server side cursor
+ *
+ * Only one batch of rows is held in memory at a time.
+ */
+// ----------------------------------------------------------------------
+
+class Cursor
+{
+ public:
+  Cursor(Fmi::Database::PostgreSQLConnection::Transaction& transaction,
+         std::string name,
+         const std::string& query,
+         int fetchSize)
+      : itsTransaction(transaction),
+        itsName(std::move(name)),
+        itsFetch("FETCH " + std::to_string(std::max(fetchSize, 1)) + " FROM " + itsName + ";")
+  {
+    itsTransaction.execute("DECLARE " + itsName + " NO SCROLL CURSOR FOR " + query + ";");
+  }
+
+  ~Cursor()
+  {
+    try
+    {
+      itsTransaction.execute("CLOSE " + itsName + ";");
+    }
+    catch (...)
+    {
+      // The cursor is closed with the transaction anyway
+    }
+  }
+
+  Cursor(const Cursor& other) = delete;
+  Cursor& operator=(const Cursor& other) = delete;
+  Cursor(Cursor&& other) = delete;
+  Cursor& operator=(Cursor&& other) = delete;
+
+  // Advance to the next row, returns false at the end
+  bool next()
+  {
+    if (++itsPos < itsBatch.size())
+      return true;
+    if (itsDone)
+      return false;
+    itsBatch = itsTransaction.execute(itsFetch);
+    itsPos = 0;
+    itsDone = itsBatch.empty();
+    return !itsDone;
+  }
+
+  pqxx::row row() const { return itsBatch[static_cast<int>(itsPos)]; }
+
+ private:
+  Fmi::Database::PostgreSQLConnection::Transaction& itsTransaction;
+  std::string itsName;
+  std::string itsFetch;
+  pqxx::result itsBatch;
+  std::size_t itsPos = 0;
+  bool itsDone = false;
+};
+
+// Remove a sequence number from the gap containing it, false if it is in no gap
+template <typename Gaps>
+bool fillGap(Gaps& gaps, long long seq)
+{
+  auto it = gaps.upper_bound(seq);
+  if (it == gaps.begin())
+    return false;
+  --it;
+  if (seq > it->second.last)
+    return false;
+
+  const auto first = it->first;
+  const auto gap = it->second;
+  gaps.erase(it);
+  if (first < seq)
+  {
+    gaps[first] = gap;
+    gaps[first].last = seq - 1;
+  }
+  if (seq < gap.last)
+    gaps[seq + 1] = gap;
+  return true;
+}
+
+// Drop the gaps whose transactions have all finished, the rows missing from them were rolled
+// back. Then all changes up to the first remaining gap are included.
+template <typename State>
+void resolveGaps(State& state, long long xmin)
+{
+  for (auto it = state.gaps.begin(); it != state.gaps.end();)
+  {
+    if (it->second.xmax >= 0 && it->second.xmax <= xmin)
+      it = state.gaps.erase(it);
+    else
+      ++it;
+  }
+  state.sequence = (state.gaps.empty() ? state.highest : state.gaps.begin()->first - 1);
+}
+
+}  // namespace
+
+PostgresSource::PostgresSource(SourceConfig config) : itsConfig(std::move(config)) {}
+
+Fmi::Database::PostgreSQLConnection& PostgresSource::connection()
+{
+  using namespace Fmi::Database;
+  try
+  {
+    if (itsConnection)
+      return *itsConnection;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (now < itsNextConnectAttempt)
+      throw Fmi::Exception(BCP, "Waiting before reconnecting to the database");
+
+    PostgreSQLConnectionOptions opt;
+    opt.host = itsConfig.dBHost;
+    opt.port = itsConfig.port;
+    opt.database = itsConfig.database;
+    opt.username = itsConfig.user;
+    opt.password = itsConfig.password;
+    opt.connect_timeout = static_cast<unsigned int>(std::max(itsConfig.timeoutSeconds, 0));
+
+    try
+    {
+      itsConnection = std::make_unique<PostgreSQLConnection>(opt);
+      itsReconnectDelay = std::chrono::seconds(0);
+    }
+    catch (...)
+    {
+      // Back off exponentially up to five minutes
+      itsReconnectDelay = std::min(std::max(2 * itsReconnectDelay, std::chrono::seconds(1)),
+                                   std::chrono::seconds(300));
+      itsNextConnectAttempt = now + itsReconnectDelay;
+      throw;
+    }
+
+    return *itsConnection;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+PostgresSource::Transaction& PostgresSource::transaction()
+{
+  if (!itsTransaction)
+    throw Fmi::Exception(BCP, "No update round in progress");
+  return *itsTransaction;
+}
+
+void PostgresSource::begin()
+{
+  try
+  {
+    itsTransaction = connection().transaction();
+    itsRoundChangelog = itsChangelog;
+
+    // The changelog and the tables must be read from the same database snapshot
+    if (!itsConfig.changelogTable.empty())
+      itsTransaction->execute("SET TRANSACTION ISOLATION LEVEL REPEATABLE READ;");
+  }
+  catch (...)
+  {
+    end(false);
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PostgresSource::end(bool success)
+{
+  itsTransaction.reset();
+  if (success)
+    itsChangelog = std::move(itsRoundChangelog);
+  else
+    itsConnection.reset();  // The connection may be broken, a new one is opened next time
+}
+
+std::string PostgresSource::validUntilExpression(const std::string& table) const
+{
+  return "floor(extract(epoch FROM " + table + itsConfig.validUntilColumn + "))::bigint";
+}
+
+std::string PostgresSource::version()
+{
+  try
+  {
+    // The changelog tells the changes, and without change detection the tables are always
+    // reloaded
+    if (!itsConfig.changelogTable.empty() || !itsConfig.changeDetection)
+      return "";
+
+    std::string query = itsConfig.versionQuery;
+    if (query.empty())
+    {
+      // Row counts plus order independent sums of 64 bit row hashes. This still scans the
+      // tables, but on the database server instead of transferring and rebuilding everything.
+      const auto tokenTable = itsConfig.schema + "." + itsConfig.tokenTable;
+      const auto authTable = itsConfig.schema + "." + itsConfig.authTable;
+      const auto authColumns = std::string("apikey,service,token") +
+                               (itsConfig.validUntilColumn.empty() ? "" : ",") +
+                               itsConfig.validUntilColumn;
+      auto checksum = [](const std::string& columns, const std::string& table) {
+        return "(SELECT count(*),coalesce(sum(('x'||left(md5(concat_ws(chr(31)," + columns +
+               ")),16))::bit(64)::bigint),0) FROM " + table + ")";
+      };
+      query = "SELECT t.*,a.* FROM " + checksum("service,token,value", tokenTable) + " AS t," +
+              checksum(authColumns, authTable) + " AS a;";
+    }
+
+    pqxx::result res = transaction().execute(query);
+
+    std::string version;
+    for (auto row : res)
+      for (std::size_t i = 0; i < row.size(); i++)
+      {
+        version += (row[i].is_null() ? "null" : row[i].c_str());
+        version += ',';
+      }
+    return version;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PostgresSource::snapshotBounds(long long& xmin, long long& xmax)
+{
+  try
+  {
+    auto res = transaction().execute(
+        "SELECT txid_snapshot_xmin(s),txid_snapshot_xmax(s) FROM txid_current_snapshot() AS s;");
+    res[0][0].to(xmin);
+    res[0][1].to(xmax);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PostgresSource::readChangelogGaps(ChangelogState& state)
+{
+  try
+  {
+    // Only the ranges of missing sequence numbers are transferred
+    const auto table = itsConfig.schema + "." + itsConfig.changelogTable;
+    const auto from = std::to_string(state.sequence);
+    auto res = transaction().execute(
+        "SELECT seq+1,next-1 FROM (SELECT seq,lead(seq) OVER (ORDER BY seq) AS next FROM "
+        "(SELECT " + from + "::bigint AS seq UNION ALL SELECT seq FROM " + table +
+        " WHERE seq > " + from + ") AS s) AS g WHERE next > seq+1 ORDER BY seq;");
+    for (auto row : res)
+    {
+      long long first = 0;
+      Gap gap;
+      row[0].to(first);
+      row[1].to(gap.last);
+      state.gaps[first] = gap;
+    }
+
+    res = transaction().execute("SELECT coalesce(max(seq)," + from + ") FROM " + table +
+                                " WHERE seq > " + from + ";");
+    res[0][0].to(state.highest);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool PostgresSource::changes(std::vector<RowChange>& changes)
+{
+  try
+  {
+    auto& state = itsRoundChangelog;
+    if (itsConfig.changelogTable.empty() || state.sequence < 0)
+      return false;
+
+    long long xmin = 0;
+    long long xmax = 0;
+    snapshotBounds(xmin, xmax);
+    for (auto& gap : state.gaps)
+      if (gap.second.xmax < 0)
+        gap.second.xmax = xmax;
+
+    // Changes after the first gap are read again until the gap is resolved, but only the ones
+    // not included yet are applied
+    const std::string query =
+        "SELECT seq,operation,table_name,apikey,service,token,value" +
+        (itsConfig.validUntilColumn.empty() ? std::string() : "," + validUntilExpression("")) +
+        " FROM " + itsConfig.schema + "." + itsConfig.changelogTable +
+        " WHERE seq > " + std::to_string(state.sequence) + " ORDER BY seq;";
+    pqxx::result res = transaction().execute(query);
+
+    for (auto row : res)
+    {
+      long long seq = 0;
+      row[0].to(seq);
+
+      // A change committed after later ones fills a gap, and a change beyond the highest one
+      // seen so far may open a new gap
+      if (seq <= state.highest)
+      {
+        if (!fillGap(state.gaps, seq))
+          continue;
+      }
+      else
+      {
+        if (seq > state.highest + 1)
+          state.gaps[state.highest + 1] = Gap{seq - 1, -1};
+        state.highest = seq;
+      }
+
+      std::string operation;
+      std::string table;
+      RowChange change;
+
+      row[1].to(operation);
+      row[2].to(table);
+      if (!row[3].is_null())
+        row[3].to(change.apikey);
+      row[4].to(change.service);
+      row[5].to(change.token);
+      if (!row[6].is_null())
+        row[6].to(change.value);
+      if (row.size() > 7 && !row[7].is_null())
+        row[7].to(change.validUntil);
+
+      change.insert = (operation == "insert" || operation == "I");
+      if (!change.insert && operation != "delete" && operation != "D")
+        throw Fmi::Exception(BCP, "Unknown changelog operation")
+            .addParameter("Operation", operation);
+
+      if (table == itsConfig.authTable)
+        change.grant = true;
+      else if (table != itsConfig.tokenTable)
+        throw Fmi::Exception(BCP, "Unknown changelog table").addParameter("Table", table);
+
+      changes.push_back(std::move(change));
+    }
+
+    resolveGaps(state, xmin);
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PostgresSource::load(RowSink& sink)
+{
+  try
+  {
+    // The position in the changelog matching the tables read in the same snapshot. Changelog
+    // rows of transactions still running are not visible, and are applied once they commit.
+    if (!itsConfig.changelogTable.empty())
+    {
+      ChangelogState state;
+      state.sequence = 0;
+      readChangelogGaps(state);
+      resolveGaps(state, 0);
+      itsRoundChangelog = std::move(state);
+    }
+
+    if (itsConfig.joinedLoad)
+      loadJoined(sink);
+    else
+      loadTables(sink);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PostgresSource::loadTables(RowSink& sink)
+{
+  try
+  {
+    // Stream both tables ordered by service, and build each service as soon as all of its
+    // rows have been read. Byte order collation keeps the order consistent with std::string.
+    Cursor tokens(transaction(),
+                  "auth_tokens",
+                  "SELECT service,token,value FROM " + itsConfig.schema + "." +
+                      itsConfig.tokenTable + " ORDER BY service COLLATE \"C\"",
+                  itsConfig.fetchSize);
+    // Grants which have already expired are not loaded at all
+    const auto& column = itsConfig.validUntilColumn;
+    Cursor grants(transaction(),
+                  "auth_grants",
+                  "SELECT apikey,service,token" +
+                      (column.empty() ? std::string() : "," + validUntilExpression("")) +
+                      " FROM " + itsConfig.schema + "." + itsConfig.authTable +
+                      (column.empty() ? std::string()
+                                      : " WHERE " + column + " IS NULL OR " + column + ">now()") +
+                      " ORDER BY service COLLATE \"C\"",
+                  itsConfig.fetchSize);
+
+    std::string apikey;
+    std::string tokenService;
+    std::string grantService;
+    std::string token;
+    std::string value;
+    std::int64_t validUntil = NO_EXPIRY;
+
+    // Indexing like so should be safe, database columns are 'not null'
+    bool hasToken = tokens.next();
+    if (hasToken)
+      tokens.row()[0].to(tokenService);
+    bool hasGrant = grants.next();
+    if (hasGrant)
+      grants.row()[1].to(grantService);
+
+    while (hasToken || hasGrant)
+    {
+      std::string service;
+      if (!hasGrant || (hasToken && tokenService < grantService))
+        service = tokenService;
+      else
+        service = grantService;
+
+      while (hasToken && tokenService == service)
+      {
+        const auto row = tokens.row();
+        row[1].to(token);
+        row[2].to(value);
+        sink.tokenValue(service, token, value);
+        hasToken = tokens.next();
+        if (hasToken)
+          tokens.row()[0].to(tokenService);
+      }
+
+      while (hasGrant && grantService == service)
+      {
+        const auto row = grants.row();
+        row[0].to(apikey);
+        row[2].to(token);
+        validUntil = NO_EXPIRY;
+        if (row.size() > 3 && !row[3].is_null())
+          row[3].to(validUntil);
+        sink.grant(apikey, service, token, validUntil);
+        hasGrant = grants.next();
+        if (hasGrant)
+          grants.row()[1].to(grantService);
+      }
+
+      sink.finish(service);
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void PostgresSource::loadJoined(RowSink& sink)
+{
+  try
+  {
+    // Every token definition is joined with every grant of the token, and tokens which are not
+    // granted to anyone appear once with a null apikey. Wildcard grants are not joined with
+    // definitions, since they grant everything anyway.
+    const auto tokenTable = itsConfig.schema + "." + itsConfig.tokenTable;
+    const auto& column = itsConfig.validUntilColumn;
+    const auto authTable =
+        (column.empty() ? itsConfig.schema + "." + itsConfig.authTable
+                        : "(SELECT * FROM " + itsConfig.schema + "." + itsConfig.authTable +
+                              " WHERE " + column + " IS NULL OR " + column + ">now())");
+    Cursor rows(transaction(),
+                "auth_rows",
+                "SELECT service,apikey,token,value,valid_until FROM (SELECT coalesce(a.service,"
+                "t.service) AS service,a.apikey,coalesce(a.token,t.token) AS token,t.value," +
+                    (column.empty() ? std::string("NULL::bigint") : validUntilExpression("a.")) +
+                    " AS valid_until FROM " + authTable + " a FULL OUTER JOIN " + tokenTable +
+                    " t ON a.service=t.service AND a.token=t.token AND a.token<>'" +
+                    WILDCARD_IDENTIFIER +
+                    "') AS rows ORDER BY service COLLATE \"C\",apikey COLLATE \"C\","
+                    "token COLLATE \"C\"",
+                itsConfig.fetchSize);
+
+    // Tokens whose values have already been added. The values of a token repeat for each
+    // apikey granted the token, but only the first (apikey, token) group needs to be read.
+    std::set<std::string> seenTokens;
+
+    std::string currentService;
+    std::string service;
+    std::string apikey;
+    std::string token;
+    std::string value;
+    std::string groupApikey;
+    std::string groupToken;
+    std::int64_t validUntil = NO_EXPIRY;
+    std::int64_t groupValidUntil = NO_EXPIRY;
+    bool groupHasApikey = false;
+    bool inGroup = false;
+    bool firstGroup = false;
+    bool haveService = false;
+
+    while (rows.next())
+    {
+      const auto row = rows.row();
+      row[0].to(service);
+
+      if (!haveService || service != currentService)
+      {
+        // The rows are sorted by service, hence the previous service is complete
+        if (haveService)
+          sink.finish(currentService);
+        currentService = service;
+        haveService = true;
+        seenTokens.clear();
+        inGroup = false;
+      }
+
+      const bool hasApikey = !row[1].is_null();
+      if (hasApikey)
+        row[1].to(apikey);
+      else
+        apikey.clear();
+      row[2].to(token);
+      validUntil = NO_EXPIRY;
+      if (!row[4].is_null())
+        row[4].to(validUntil);
+
+      if (!inGroup || hasApikey != groupHasApikey || apikey != groupApikey ||
+          token != groupToken)
+      {
+        inGroup = true;
+        groupHasApikey = hasApikey;
+        groupApikey = apikey;
+        groupToken = token;
+        groupValidUntil = validUntil;
+        if (hasApikey)
+          sink.grant(apikey, service, token, validUntil);
+        firstGroup = seenTokens.insert(token).second;
+      }
+      else if (hasApikey && validUntil != groupValidUntil)
+      {
+        // Duplicate grant rows with different expiry times, the sink keeps the longest
+        groupValidUntil = validUntil;
+        sink.grant(apikey, service, token, validUntil);
+      }
+
+      if (firstGroup && !row[3].is_null())
+      {
+        row[3].to(value);
+        sink.tokenValue(service, token, value);
+      }
+    }
+
+    if (haveService)
+      sink.finish(currentService);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+bool PostgresSource::quotas(QuotaData& quotas)
+{
+  try
+  {
+    // The quota table is small and is not covered by the changelog nor the change detection,
+    // hence it is read on every round
+    if (itsConfig.quotaTable.empty())
+      return false;
+
+    pqxx::result res = transaction().execute("SELECT apikey,service,rate,burst FROM " +
+                                             itsConfig.schema + "." + itsConfig.quotaTable + ";");
+
+    std::string apikey;
+    std::string service;
+    for (auto row : res)
+    {
+      QuotaLimit limit;
+      row[0].to(apikey);
+      row[1].to(service);
+      row[2].to(limit.rate);
+      row[3].to(limit.burst);
+      quotas[std::make_pair(service, apikey)] = limit;
+    }
+    return true;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
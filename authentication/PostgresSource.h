@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Config.h"
+#include "DataSource.h"
+#include <macgyver/PostgreSQLConnection.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Data read from the authorization tables of the database
+ *
+ * Each update round reads the tables in a single transaction. Changes are
+ * read from the optional changelog table, and otherwise the tables are
+ * probed for changes before they are reloaded.
+ *
+ * Transactions may commit their changelog rows out of order, and rolled
+ * back transactions leave sequence numbers unused. Changes are applied as
+ * soon as they become visible, and the sequence numbers skipped so far are
+ * read again on later rounds until the database snapshot shows that every
+ * transaction which might still commit them has finished.
+ */
+// ----------------------------------------------------------------------
+
+class PostgresSource : public DataSource
+{
+ public:
+  explicit PostgresSource(SourceConfig config);
+
+  void begin() override;
+  void end(bool success) override;
+
+  std::string version() override;
+  void load(RowSink& sink) override;
+  bool changes(std::vector<RowChange>& changes) override;
+  bool quotas(QuotaData& quotas) override;
+
+ private:
+  using Transaction = Fmi::Database::PostgreSQLConnection::Transaction;
+
+  // Persistent database connection, reopened with exponential backoff after failures
+  Fmi::Database::PostgreSQLConnection& connection();
+
+  // Transaction of the current round
+  Transaction& transaction();
+
+  // Expression for the expiry time of a row in epoch seconds, null if the row never expires
+  std::string validUntilExpression(const std::string& table) const;
+
+  // Load the tables with one cursor per table, merged by service
+  void loadTables(RowSink& sink);
+
+  // Load the tables with a single sorted join
+  void loadJoined(RowSink& sink);
+
+  const SourceConfig itsConfig;
+
+  std::unique_ptr<Fmi::Database::PostgreSQLConnection> itsConnection;
+  std::chrono::steady_clock::time_point itsNextConnectAttempt;
+  std::chrono::seconds itsReconnectDelay{0};
+
+  std::shared_ptr<Transaction> itsTransaction;
+
+  // Sequence numbers of the changelog not seen yet, from first to last. The next transaction id
+  // of the database on the round after the gap was first seen tells when every transaction which
+  // might still commit the missing rows has finished. A transaction may draw its sequence number
+  // just before it is assigned a transaction id, hence the id is taken only on the next round.
+  struct Gap
+  {
+    long long last = 0;
+    long long xmax = -1;  // negative until the next round
+  };
+
+  // Position in the changelog of the data taken into use
+  struct ChangelogState
+  {
+    long long sequence = -1;        // all changes up to this one are included, negative if unknown
+    long long highest = -1;         // highest change included
+    std::map<long long, Gap> gaps;  // changes above sequence which are not included
+  };
+
+  // The oldest transaction still running and the next transaction id in the snapshot of the round
+  void snapshotBounds(long long& xmin, long long& xmax);
+
+  // Read the gaps in the changelog above the sequence number of the state, and the highest
+  // sequence number
+  void readChangelogGaps(ChangelogState& state);
+
+  // Of the data taken into use, and of the current round
+  ChangelogState itsChangelog;
+  ChangelogState itsRoundChangelog;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,185 @@
+#include "QuotaTable.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+std::int64_t steadyNanoseconds() noexcept
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Threads are assigned to shards round robin on first use
+std::size_t threadShard()
+{
+  static std::atomic<std::size_t> next{0};
+  thread_local const std::size_t index = next.fetch_add(1);
+  return index;
+}
+
+}  // namespace
+
+QuotaTable::QuotaTable(QuotaData quotas, const QuotaTable* previous) : itsData(std::move(quotas))
+{
+  try
+  {
+    // The map is sorted by service, hence the quotas of each service are consecutive
+    std::vector<std::string_view> services;
+    std::vector<std::vector<std::string_view>> apikeys;
+    for (const auto& quota : itsData)
+    {
+      if (services.empty() || services.back() != quota.first.first)
+      {
+        services.push_back(quota.first.first);
+        apikeys.emplace_back();
+      }
+      apikeys.back().push_back(quota.first.second);
+
+      const auto& limit = quota.second;
+      if (!std::isfinite(limit.rate) || !std::isfinite(limit.burst) || limit.burst < 0)
+        throw Fmi::Exception(BCP, "Invalid quota")
+            .addParameter("Service", quota.first.first)
+            .addParameter("Apikey", quota.first.second);
+
+      // Every shard must hold at least one request, and the remainder of the burst is given
+      // to the first shards
+      Limit shard{0, 0, 0, 0};
+      if (limit.rate > 0 && limit.burst > 0)
+      {
+        const double requests = std::clamp(std::floor(limit.burst), 1.0, 1e9);
+        const auto count = static_cast<std::uint32_t>(requests);
+        shard.shards = std::min(count, static_cast<std::uint32_t>(ShardCount));
+        shard.extra = count % shard.shards;
+        const double interval = std::clamp(1e9 * shard.shards / limit.rate, 1.0, 1e15);
+        shard.interval = static_cast<std::int64_t>(interval);
+        shard.tolerance = static_cast<std::int64_t>(count / shard.shards) * shard.interval;
+      }
+      itsLimits.push_back(shard);
+    }
+
+    if (itsLimits.size() >= StringTable::npos)
+      throw Fmi::Exception(BCP, "Too many quotas");
+
+    ImageWriter writer(0);
+    const auto serviceSections = StringTable::write(writer, services);
+    std::vector<StringTable::Sections> apikeySections;
+    for (const auto& keys : apikeys)
+      apikeySections.push_back(StringTable::write(writer, keys));
+    const auto size = writer.size();
+    itsImage = writer.release();
+
+    const auto* image = reinterpret_cast<const char*>(itsImage->data());
+    itsServices = StringTable(image, size, serviceSections);
+    std::uint32_t first = 0;
+    for (std::size_t i = 0; i < apikeySections.size(); i++)
+    {
+      itsApikeys.emplace_back(image, size, apikeySections[i]);
+      itsFirst.push_back(first);
+      first += static_cast<std::uint32_t>(apikeys[i].size());
+    }
+
+    itsLinesPerShard = (itsLimits.size() + 7) / 8;
+    itsBuckets.reset(new Line[ShardCount * itsLinesPerShard]);
+    for (std::size_t i = 0; i < ShardCount * itsLinesPerShard; i++)
+      for (auto& next : itsBuckets[i].next)
+        next.store(0, std::memory_order_relaxed);
+
+    if (!previous)
+      return;
+
+    // The requests spent but not yet refilled are carried over, also when the limits change.
+    // They fill the new shards one at a time, and any excess is spread evenly.
+    const auto now = steadyNanoseconds();
+    std::uint32_t id = 0;
+    for (const auto& quota : itsData)
+    {
+      const auto old = previous->find(quota.first.first, quota.first.second);
+      const auto& limit = itsLimits[id];
+      if (old != StringTable::npos && limit.shards > 0)
+      {
+        const auto& oldLimit = previous->itsLimits[old];
+        double spent = 0;
+        for (std::size_t shard = 0; shard < oldLimit.shards; shard++)
+        {
+          const auto next = previous->bucket(shard, old).load(std::memory_order_relaxed);
+          spent += static_cast<double>(std::max<std::int64_t>(next - now, 0)) /
+                   static_cast<double>(oldLimit.interval);
+        }
+
+        // Requests which fit in a shard, the first shards hold one more
+        const double capacity = static_cast<double>(limit.tolerance) / limit.interval;
+        const double excess =
+            std::max(0.0, spent - capacity * limit.shards - limit.extra) / limit.shards;
+        for (std::size_t shard = 0; shard < limit.shards; shard++)
+        {
+          const double fill = std::min(spent, capacity + (shard < limit.extra ? 1 : 0));
+          spent -= fill;
+          const double ahead = std::min((fill + excess) * limit.interval, 1e18);
+          bucket(shard, id).store(now + static_cast<std::int64_t>(ahead),
+                                  std::memory_order_relaxed);
+        }
+      }
+      id++;
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::uint32_t QuotaTable::find(std::string_view service, std::string_view apikey) const
+{
+  const auto serviceId = itsServices.find(service);
+  if (serviceId == StringTable::npos)
+    return StringTable::npos;
+  const auto apikeyId = itsApikeys[serviceId].find(apikey);
+  if (apikeyId == StringTable::npos)
+    return StringTable::npos;
+  return itsFirst[serviceId] + apikeyId;
+}
+
+bool QuotaTable::consume(std::string_view service, std::string_view apikey) const
+{
+  const auto id = find(service, apikey);
+  if (id == StringTable::npos)
+    return true;
+
+  const auto& limit = itsLimits[id];
+  if (limit.shards == 0)
+    return false;
+
+  const auto now = steadyNanoseconds();
+  const auto first = threadShard() % limit.shards;
+  for (std::size_t i = 0; i < limit.shards; i++)
+  {
+    const auto shard = (first + i) % limit.shards;
+    const auto tolerance = limit.tolerance + (shard < limit.extra ? limit.interval : 0);
+    auto& next = bucket(shard, id);
+    auto expected = next.load(std::memory_order_relaxed);
+    while (true)
+    {
+      // An idle bucket is full, but does not save up more than the tolerance
+      const auto spent = std::max(expected, now) + limit.interval;
+      if (spent - now > tolerance)
+        break;
+      if (next.compare_exchange_weak(expected, spent, std::memory_order_relaxed))
+        return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "FlatImage.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// Sustained requests per second, and the number of requests which may be made at once
+struct QuotaLimit
+{
+  double rate = 0;
+  double burst = 0;
+
+  bool operator==(const QuotaLimit& other) const
+  {
+    return rate == other.rate && burst == other.burst;
+  }
+  bool operator!=(const QuotaLimit& other) const { return !(*this == other); }
+};
+
+// (service, apikey) -> limit
+using QuotaData = std::map<std::pair<std::string, std::string>, QuotaLimit>;
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Request quotas of apikeys enforced with lock-free token buckets
+ *
+ * Each bucket is a single atomic word holding the theoretical arrival
+ * time of the next request (the generic cell rate algorithm), updated
+ * with a compare-and-swap. The budget of each quota is split evenly into
+ * shards, and threads are assigned to shards round robin, so threads
+ * spending the same quota mostly update different cache lines. Only when
+ * the shard of a thread is empty are the other shards tried, hence the
+ * total rate and burst of the quota are still honoured.
+ *
+ * The buckets of all quotas are stored shard by shard, so that threads of
+ * different shards never share a cache line.
+ *
+ * The limits are immutable. A table built from new limits continues from
+ * the buckets of the previous one, so that reloading the limits does not
+ * refill the buckets.
+ */
+// ----------------------------------------------------------------------
+
+class QuotaTable
+{
+ public:
+  static constexpr std::size_t ShardCount = 8;
+
+  QuotaTable() = default;
+
+  // The requests spent from each quota are carried over from the previous table if one is given,
+  // also when the limits of the quota have changed
+  QuotaTable(QuotaData quotas, const QuotaTable* previous);
+
+  QuotaTable(const QuotaTable& other) = delete;
+  QuotaTable& operator=(const QuotaTable& other) = delete;
+  QuotaTable(QuotaTable&& other) = delete;
+  QuotaTable& operator=(QuotaTable&& other) = delete;
+
+  // Spend one request from the quota, false if the quota is exhausted. Apikeys without a quota
+  // for the service are not limited.
+  bool consume(std::string_view service, std::string_view apikey) const;
+
+  const QuotaData& data() const { return itsData; }
+
+  std::size_t size() const { return itsLimits.size(); }
+
+ private:
+  // Limits of the shards of a quota, times in nanoseconds
+  struct Limit
+  {
+    std::int64_t interval;   // time per request
+    std::int64_t tolerance;  // how far ahead of the present requests may be spent
+    std::uint32_t shards;    // number of shards in use, zero if all requests are refused
+    std::uint32_t extra;     // number of first shards holding one more request
+  };
+
+  struct alignas(64) Line
+  {
+    std::atomic<std::int64_t> next[8];
+  };
+
+  // Id of the quota, StringTable::npos if there is none
+  std::uint32_t find(std::string_view service, std::string_view apikey) const;
+
+  std::atomic<std::int64_t>& bucket(std::size_t shard, std::uint32_t quota) const
+  {
+    return itsBuckets[shard * itsLinesPerShard + quota / 8].next[quota % 8];
+  }
+
+  QuotaData itsData;
+
+  std::shared_ptr<const ImageBuffer> itsImage;
+  StringTable itsServices;
+  std::vector<StringTable> itsApikeys;  // service id -> apikeys
+  std::vector<std::uint32_t> itsFirst;  // service id -> id of its first quota
+
+  std::vector<Limit> itsLimits;
+  std::size_t itsLinesPerShard = 0;
+  std::unique_ptr<Line[]> itsBuckets;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
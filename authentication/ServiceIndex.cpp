@@ -0,0 +1,795 @@
+#include "ServiceIndex.h"
+#include "CoarseClock.h"
+#include <macgyver/Exception.h>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <unordered_map>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+const std::uint32_t IMAGE_MAGIC = 0x48545541;  // "AUTH"
+const std::uint32_t IMAGE_VERSION = 8;
+
+// Canonical decimal integer: optional minus sign, no leading zeros nor plus sign
+bool parseInteger(std::string_view str, std::int64_t& result)
+{
+  const bool negative = (!str.empty() && str.front() == '-');
+  if (negative)
+    str.remove_prefix(1);
+  if (str.empty() || str.size() > 19 || (str.front() == '0' && (str.size() > 1 || negative)))
+    return false;
+
+  std::uint64_t value = 0;
+  for (const char ch : str)
+  {
+    if (ch < '0' || ch > '9')
+      return false;
+    value = 10 * value + static_cast<std::uint64_t>(ch - '0');
+  }
+
+  const std::uint64_t limit = std::numeric_limits<std::int64_t>::max();
+  if (value > limit + (negative ? 1 : 0))
+    return false;
+  result = (negative ? static_cast<std::int64_t>(0 - value) : static_cast<std::int64_t>(value));
+  return true;
+}
+
+// Token value of form "lo..hi"
+bool parseRange(std::string_view str, std::int64_t& lo, std::int64_t& hi)
+{
+  const auto pos = str.find("..");
+  return (pos != std::string_view::npos && parseInteger(str.substr(0, pos), lo) &&
+          parseInteger(str.substr(pos + 2), hi) && lo <= hi);
+}
+
+// Token value of form "prefix*". A lone "*" would grant every value, hence it is a plain value.
+bool parsePrefix(std::string_view str, std::string_view& prefix)
+{
+  if (str.size() < 2 || str.back() != '*')
+    return false;
+  prefix = str.substr(0, str.size() - 1);
+  return true;
+}
+
+// Match a single range or prefix token value
+bool matchesValue(std::string_view pattern, std::string_view value)
+{
+  std::int64_t lo = 0;
+  std::int64_t hi = 0;
+  std::int64_t number = 0;
+  if (parseRange(pattern, lo, hi))
+    return (parseInteger(value, number) && number >= lo && number <= hi);
+
+  std::string_view prefix;
+  return (parsePrefix(pattern, prefix) && value.substr(0, prefix.size()) == prefix);
+}
+
+// Validate that all ranges point inside a pool and all ids in the pool are below the limit
+void validatePool(const ArrayView<PoolRange>& ranges,
+                  const ArrayView<std::uint32_t>& pool,
+                  std::size_t limit)
+{
+  for (const auto& range : ranges)
+    if (range.offset > pool.size() || range.count > pool.size() - range.offset)
+      throw Fmi::Exception(BCP, "Image pool range out of bounds");
+  for (const auto id : pool)
+    if (id >= limit)
+      throw Fmi::Exception(BCP, "Image id out of bounds");
+}
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Appends id lists into a pool, storing identical lists only once
+ *
+ * Thousands of apikeys typically share the same few token bundles, and
+ * hash-consing the lists makes all of them refer to the same range.
+ */
+// ----------------------------------------------------------------------
+
+class PoolBuilder
+{
+ public:
+  PoolRange add(const std::vector<std::uint32_t>& ids)
+  {
+    itsRequestedSize += ids.size();
+
+    std::uint64_t hash = ids.size();
+    for (const auto id : ids)
+      hash = (hash ^ id) * 0x100000001B3ULL;
+
+    auto candidates = itsRanges.equal_range(hash);
+    for (auto it = candidates.first; it != candidates.second; ++it)
+    {
+      const auto& range = it->second;
+      if (range.count == ids.size() &&
+          std::equal(ids.begin(), ids.end(), itsPool.begin() + range.offset))
+        return range;
+    }
+
+    if (itsPool.size() + ids.size() >= StringTable::npos)
+      throw Fmi::Exception(BCP, "Image pool too large");
+
+    PoolRange range{static_cast<std::uint32_t>(itsPool.size()),
+                    static_cast<std::uint32_t>(ids.size())};
+    itsPool.insert(itsPool.end(), ids.begin(), ids.end());
+    itsRanges.emplace(hash, range);
+    return range;
+  }
+
+  const std::vector<std::uint32_t>& pool() const { return itsPool; }
+
+  ArrayView<std::uint32_t> slice(const PoolRange& range) const
+  {
+    return ArrayView<std::uint32_t>(itsPool.data() + range.offset, range.count);
+  }
+
+  // Bytes which would have been needed without sharing identical lists
+  std::size_t savedBytes() const
+  {
+    return (itsRequestedSize - itsPool.size()) * sizeof(std::uint32_t);
+  }
+
+ private:
+  std::vector<std::uint32_t> itsPool;
+  std::unordered_multimap<std::uint64_t, PoolRange> itsRanges;
+  std::size_t itsRequestedSize = 0;
+};
+
+}  // namespace
+
+struct ServiceIndex::Header
+{
+  std::uint32_t magic;
+  std::uint32_t version;
+  ImageSection name;
+  StringTable::Sections apikeys;
+  StringTable::Sections values;
+  StringTable::Sections tokens;
+  ImageSection tokenValues;
+  ImageSection valueIds;
+  ImageSection grants;
+  ImageSection grantTokens;
+  ImageSection grantValues;
+  std::uint64_t sharedBytes;
+  ImageSection apikeyFilter;
+  std::uint32_t apikeyFilterK;
+  std::uint32_t reserved;
+  double apikeyFilterRate;
+  ImageSection ranges;
+  StringTable::Sections prefixes;
+  ImageSection grantRanges;
+  ImageSection grantPrefixes;
+  ImageSection expiries;
+};
+
+std::uint32_t ServiceIndex::Builder::intern(IdMap& ids,
+                                            std::vector<std::string_view>& strings,
+                                            const std::string& str)
+{
+  auto result = ids.emplace(str, static_cast<std::uint32_t>(strings.size()));
+  if (result.second)
+    strings.push_back(result.first->first);
+  return result.first->second;
+}
+
+void ServiceIndex::Builder::addTokenValue(const std::string& token, const std::string& value)
+{
+  try
+  {
+    const auto tokenId = intern(itsTokenIds, itsTokens, token);
+    if (tokenId == itsTokenValues.size())
+      itsTokenValues.emplace_back();
+    itsTokenValues[tokenId].push_back(intern(itsValueIds, itsValues, value));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void ServiceIndex::Builder::addGrant(const std::string& apikey,
+                                     const std::string& token,
+                                     std::int64_t validUntil)
+{
+  try
+  {
+    const auto apikeyId = intern(itsApikeyIds, itsApikeys, apikey);
+    if (apikeyId == itsGrants.size())
+    {
+      itsGrants.emplace_back();
+      itsGrantExpiries.emplace_back();
+      itsWildcards.push_back(0);
+    }
+
+    if (token == WILDCARD_IDENTIFIER)
+      itsWildcards[apikeyId] = std::max(itsWildcards[apikeyId], validUntil);
+    else
+    {
+      // Tokens which are granted but have no definitions are misconfigurations in the
+      // database. They are kept in the index with no values so that the index contains
+      // all the data.
+      const auto tokenId = intern(itsTokenIds, itsTokens, token);
+      if (tokenId == itsTokenValues.size())
+        itsTokenValues.emplace_back();
+      itsGrants[apikeyId].push_back(tokenId);
+      itsGrantExpiries[apikeyId].push_back(validUntil);
+    }
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::shared_ptr<const ServiceIndex> ServiceIndex::Builder::build() const
+{
+  try
+  {
+    // Identical value sets of different tokens are shared
+    std::vector<PoolRange> tokenValues;
+    tokenValues.reserve(itsTokens.size());
+    PoolBuilder valueIdPool;
+    std::vector<std::uint32_t> ids;
+    for (const auto& values : itsTokenValues)
+    {
+      ids = values;
+      std::sort(ids.begin(), ids.end());
+      ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+      tokenValues.push_back(valueIdPool.add(ids));
+    }
+
+    // Identical token lists and effective value sets of different apikeys are shared
+    std::vector<Grant> grants;
+    grants.reserve(itsApikeys.size());
+    PoolBuilder grantTokens;
+    PoolBuilder grantValues;
+    std::vector<std::uint32_t> tokenList;
+    std::vector<std::pair<std::uint32_t, std::int64_t>> tokenExpiries;
+    std::vector<std::int64_t> expiries;
+
+    // Ranges and prefixes of the values, and those granted to each apikey
+    std::vector<std::int8_t> valuePatterns(itsOptions.patternValues ? itsValues.size() : 0, 0);
+    std::vector<ValueRange> valueRanges(valuePatterns.size());
+    std::vector<std::string_view> valuePrefixes(valuePatterns.size());
+    for (std::size_t i = 0; i < valuePatterns.size(); i++)
+    {
+      if (parseRange(itsValues[i], valueRanges[i].lo, valueRanges[i].hi))
+        valuePatterns[i] = 1;
+      else if (parsePrefix(itsValues[i], valuePrefixes[i]))
+        valuePatterns[i] = 2;
+    }
+    const std::size_t patternApikeys = (valuePatterns.empty() ? 0 : itsApikeys.size());
+    std::vector<std::vector<ValueRange>> apikeyRanges(patternApikeys);
+    std::vector<std::vector<std::string_view>> apikeyPrefixes(apikeyRanges.size());
+
+    for (std::size_t apikeyId = 0; apikeyId < itsApikeys.size(); apikeyId++)
+    {
+      const auto wildcard = itsWildcards[apikeyId];
+      Grant grant{wildcard != 0 ? WILDCARD : 0U, 0, {}, {}, {}, {}, {}, NO_EXPIRY};
+
+      // Sorted unique tokens, of duplicates the last one sorted is valid the longest
+      const auto& tokens = itsGrants[apikeyId];
+      tokenExpiries.clear();
+      for (std::size_t i = 0; i < tokens.size(); i++)
+        tokenExpiries.emplace_back(tokens[i], itsGrantExpiries[apikeyId][i]);
+      std::sort(tokenExpiries.begin(), tokenExpiries.end());
+      tokenList.clear();
+      for (std::size_t i = 0; i < tokenExpiries.size(); i++)
+        if (i + 1 == tokenExpiries.size() || tokenExpiries[i + 1].first != tokenExpiries[i].first)
+          tokenList.push_back(tokenExpiries[i].first);
+
+      // Expiry times are stored only for apikeys with grants which expire
+      if (wildcard != 0)
+        grant.expires = wildcard;
+      for (const auto& token : tokenExpiries)
+        grant.expires = std::min(grant.expires, token.second);
+      if (grant.expires != NO_EXPIRY)
+      {
+        grant.expiries = PoolRange{static_cast<std::uint32_t>(expiries.size()),
+                                   static_cast<std::uint32_t>(tokenList.size() + 1)};
+        expiries.push_back(wildcard != 0 ? wildcard : NO_EXPIRY);
+        for (std::size_t i = 0; i < tokenExpiries.size(); i++)
+          if (i + 1 == tokenExpiries.size() || tokenExpiries[i + 1].first != tokenExpiries[i].first)
+            expiries.push_back(tokenExpiries[i].second);
+        if (expiries.size() >= StringTable::npos)
+          throw Fmi::Exception(BCP, "Image pool too large");
+      }
+
+      ids.clear();
+      for (const auto tokenId : tokenList)
+      {
+        const auto values = valueIdPool.slice(tokenValues[tokenId]);
+        if (!values.empty())
+          grant.flags |= DEFINED_TOKENS;
+        ids.insert(ids.end(), values.begin(), values.end());
+      }
+      grant.tokens = grantTokens.add(tokenList);
+
+      // Flatten the token sets into one effective set of values
+      std::sort(ids.begin(), ids.end());
+      ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+      grant.values = grantValues.add(ids);
+
+      if (!valuePatterns.empty())
+      {
+        auto& ranges = apikeyRanges[apikeyId];
+        auto& prefixes = apikeyPrefixes[apikeyId];
+        for (const auto id : ids)
+        {
+          if (valuePatterns[id] == 1)
+            ranges.push_back(valueRanges[id]);
+          else if (valuePatterns[id] == 2)
+            prefixes.push_back(valuePrefixes[id]);
+        }
+
+        // Merge overlapping and adjacent ranges into disjoint ones
+        std::sort(ranges.begin(), ranges.end(), [](const ValueRange& a, const ValueRange& b) {
+          return a.lo < b.lo;
+        });
+        std::size_t n = 0;
+        for (const auto& range : ranges)
+        {
+          if (n > 0 && (range.lo == std::numeric_limits<std::int64_t>::min() ||
+                        ranges[n - 1].hi >= range.lo - 1))
+            ranges[n - 1].hi = std::max(ranges[n - 1].hi, range.hi);
+          else
+            ranges[n++] = range;
+        }
+        ranges.resize(n);
+
+        // Drop prefixes which begin with another granted prefix. A shorter prefix sorts
+        // before all the longer ones beginning with it.
+        std::sort(prefixes.begin(), prefixes.end());
+        n = 0;
+        for (const auto& prefix : prefixes)
+          if (n == 0 || prefix.substr(0, prefixes[n - 1].size()) != prefixes[n - 1])
+            prefixes[n++] = prefix;
+        prefixes.resize(n);
+
+        if (!ranges.empty() || !prefixes.empty())
+          grant.flags |= PATTERNS;
+      }
+
+      grants.push_back(grant);
+    }
+
+    // Tables of the distinct ranges and prefixes, with ids in sorted order so that sorted
+    // id lists are also sorted by range and by prefix
+    std::map<std::pair<std::int64_t, std::int64_t>, std::uint32_t> rangeIds;
+    std::map<std::string_view, std::uint32_t> prefixIds;
+    for (std::size_t apikeyId = 0; apikeyId < apikeyRanges.size(); apikeyId++)
+    {
+      for (const auto& range : apikeyRanges[apikeyId])
+        rangeIds.emplace(std::make_pair(range.lo, range.hi), 0);
+      for (const auto& prefix : apikeyPrefixes[apikeyId])
+        prefixIds.emplace(prefix, 0);
+    }
+
+    std::vector<ValueRange> ranges;
+    for (auto& range : rangeIds)
+    {
+      range.second = static_cast<std::uint32_t>(ranges.size());
+      ranges.push_back(ValueRange{range.first.first, range.first.second});
+    }
+    std::vector<std::string_view> prefixes;
+    for (auto& prefix : prefixIds)
+    {
+      prefix.second = static_cast<std::uint32_t>(prefixes.size());
+      prefixes.push_back(prefix.first);
+    }
+
+    PoolBuilder grantRanges;
+    PoolBuilder grantPrefixes;
+    for (std::size_t apikeyId = 0; apikeyId < apikeyRanges.size(); apikeyId++)
+    {
+      ids.clear();
+      for (const auto& range : apikeyRanges[apikeyId])
+        ids.push_back(rangeIds.at(std::make_pair(range.lo, range.hi)));
+      grants[apikeyId].ranges = grantRanges.add(ids);
+
+      ids.clear();
+      for (const auto& prefix : apikeyPrefixes[apikeyId])
+        ids.push_back(prefixIds.at(prefix));
+      grants[apikeyId].prefixes = grantPrefixes.add(ids);
+    }
+
+    ImageWriter writer(sizeof(Header));
+    Header header{};
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.name = writer.append(itsName.data(), itsName.size());
+    header.apikeys = StringTable::write(writer, itsApikeys);
+    header.values = StringTable::write(writer, itsValues);
+    header.tokens = StringTable::write(writer, itsTokens);
+    header.tokenValues = writer.append(tokenValues);
+    header.valueIds = writer.append(valueIdPool.pool());
+    header.grants = writer.append(grants);
+    header.grantTokens = writer.append(grantTokens.pool());
+    header.grantValues = writer.append(grantValues.pool());
+    header.ranges = writer.append(ranges);
+    header.prefixes = StringTable::write(writer, prefixes);
+    header.grantRanges = writer.append(grantRanges.pool());
+    header.grantPrefixes = writer.append(grantPrefixes.pool());
+    header.expiries = writer.append(expiries);
+    header.sharedBytes = valueIdPool.savedBytes() + grantTokens.savedBytes() +
+                         grantValues.savedBytes() + grantRanges.savedBytes() +
+                         grantPrefixes.savedBytes();
+
+    std::vector<std::uint64_t> apikeyHashes;
+    apikeyHashes.reserve(itsApikeys.size());
+    for (const auto& apikey : itsApikeys)
+      apikeyHashes.push_back(hashString(apikey));
+    header.apikeyFilter = BloomFilter::write(
+        writer, apikeyHashes, itsOptions.apikeyFilterRate, header.apikeyFilterK);
+    header.apikeyFilterRate = (header.apikeyFilterK > 0 ? itsOptions.apikeyFilterRate : 0);
+
+    writer.writeHeader(header);
+
+    const auto size = writer.size();
+    auto image = writer.release();
+    return std::make_shared<const ServiceIndex>(
+        image, reinterpret_cast<const char*>(image->data()), size);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("Service", itsName);
+  }
+}
+
+std::shared_ptr<const ServiceIndex> ServiceIndex::build(const std::string& name,
+                                                        const ServiceData& data,
+                                                        const IndexOptions& options)
+{
+  try
+  {
+    Builder builder(name, options);
+    for (const auto& token : data.tokens)
+      for (const auto& value : token.second)
+        builder.addTokenValue(token.first, value);
+    for (const auto& apikey : data.apikeys)
+      for (const auto& token : apikey.second)
+      {
+        const auto expiry = data.expiries.find(std::make_pair(apikey.first, token));
+        builder.addGrant(
+            apikey.first, token, (expiry == data.expiries.end() ? NO_EXPIRY : expiry->second));
+      }
+    return builder.build();
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("Service", name);
+  }
+}
+
+ServiceIndex::ServiceIndex(std::shared_ptr<const void> storage,
+                           const char* image,
+                           std::size_t size)
+    : itsStorage(std::move(storage)), itsImage(image, size)
+{
+  try
+  {
+    Header header{};
+    if (size < sizeof(Header))
+      throw Fmi::Exception(BCP, "Service image is truncated");
+    std::memcpy(&header, image, sizeof(Header));
+    if (header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION)
+      throw Fmi::Exception(BCP, "Service image version mismatch");
+
+    itsStatistics.imageSize = size;
+    itsStatistics.sharedBytes = header.sharedBytes;
+
+    const auto name = imageArray<char>(image, size, header.name);
+    itsName = std::string_view(name.data(), name.size());
+
+    itsApikeys = StringTable(image, size, header.apikeys);
+    itsValues = StringTable(image, size, header.values);
+    itsTokens = StringTable(image, size, header.tokens);
+    itsTokenValues = imageArray<PoolRange>(image, size, header.tokenValues);
+    itsValueIds = imageArray<std::uint32_t>(image, size, header.valueIds);
+    itsGrants = imageArray<Grant>(image, size, header.grants);
+    itsGrantTokens = imageArray<std::uint32_t>(image, size, header.grantTokens);
+    itsGrantValues = imageArray<std::uint32_t>(image, size, header.grantValues);
+    itsPrefixes = StringTable(image, size, header.prefixes);
+    itsRanges = imageArray<ValueRange>(image, size, header.ranges);
+    itsGrantRanges = imageArray<std::uint32_t>(image, size, header.grantRanges);
+    itsGrantPrefixes = imageArray<std::uint32_t>(image, size, header.grantPrefixes);
+    itsExpiries = imageArray<std::int64_t>(image, size, header.expiries);
+    itsApikeyFilter = BloomFilter(image, size, header.apikeyFilter, header.apikeyFilterK);
+    itsApikeyFilterRate = header.apikeyFilterRate;
+    itsStatistics.filterBytes = itsApikeyFilter.bytes();
+
+    if (itsTokenValues.size() != itsTokens.size() || itsGrants.size() != itsApikeys.size())
+      throw Fmi::Exception(BCP, "Service image table size mismatch");
+
+    itsStatistics.apikeys = itsApikeys.size();
+    itsStatistics.tokens = itsTokens.size();
+    itsStatistics.values = itsValues.size();
+
+    validatePool(itsTokenValues, itsValueIds, itsValues.size());
+
+    std::vector<PoolRange> tokenRanges;
+    std::vector<PoolRange> valueRanges;
+    std::vector<PoolRange> rangeRanges;
+    std::vector<PoolRange> prefixRanges;
+    for (const auto& grant : itsGrants)
+    {
+      tokenRanges.push_back(grant.tokens);
+      valueRanges.push_back(grant.values);
+      rangeRanges.push_back(grant.ranges);
+      prefixRanges.push_back(grant.prefixes);
+
+      // The wildcard followed by each token, stored whenever some grant expires
+      if ((grant.expiries.count != 0) != (grant.expires != NO_EXPIRY))
+        throw Fmi::Exception(BCP, "Image expiry range mismatch");
+      if (grant.expiries.count != 0 &&
+          (grant.expiries.count != grant.tokens.count + 1 ||
+           grant.expiries.offset > itsExpiries.size() ||
+           grant.expiries.count > itsExpiries.size() - grant.expiries.offset))
+        throw Fmi::Exception(BCP, "Image expiry range out of bounds");
+      if (grant.expires != NO_EXPIRY)
+        itsStatistics.expiringApikeys++;
+    }
+    validatePool(ArrayView<PoolRange>(tokenRanges.data(), tokenRanges.size()),
+                 itsGrantTokens,
+                 itsTokens.size());
+    validatePool(ArrayView<PoolRange>(valueRanges.data(), valueRanges.size()),
+                 itsGrantValues,
+                 itsValues.size());
+    validatePool(ArrayView<PoolRange>(rangeRanges.data(), rangeRanges.size()),
+                 itsGrantRanges,
+                 itsRanges.size());
+    validatePool(ArrayView<PoolRange>(prefixRanges.data(), prefixRanges.size()),
+                 itsGrantPrefixes,
+                 itsPrefixes.size());
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+AccessStatus ServiceIndex::resolveAccess(std::string_view apikey,
+                                         std::string_view value,
+                                         bool explicitGrantOnly) const
+{
+  return resolveAccessById(findApikey(apikey), value, explicitGrantOnly);
+}
+
+AccessStatus ServiceIndex::resolveAccessById(std::uint32_t apikeyId,
+                                             std::string_view value,
+                                             bool explicitGrantOnly) const
+{
+  if (apikeyId == StringTable::npos)
+  {
+    // No such apikey defined for this service.
+    return explicitGrantOnly ? AccessStatus::DENY : AccessStatus::UNKNOWN_APIKEY;
+  }
+
+  const auto& grant = itsGrants[apikeyId];
+
+  // Once any grant of the apikey has expired its tokens are checked one by one
+  const auto now = CoarseClock::now();
+  if (grant.expires <= now)
+    return resolveUnexpired(grant, value, explicitGrantOnly, now);
+
+  // First check if this apikey has "wildcard" definition, it means universal access
+  if (!explicitGrantOnly && (grant.flags & WILDCARD) != 0)
+    return AccessStatus::WILDCARD_GRANT;
+
+  // An apikey with only a wildcard grant has no token definitions
+  if ((grant.flags & DEFINED_TOKENS) == 0)
+    return explicitGrantOnly ? AccessStatus::DENY : AccessStatus::UNKNOWN_APIKEY;
+
+  // See if value is defined in one of the token sets
+  const auto valueId = itsValues.find(value);
+  if (valueId != StringTable::npos)
+  {
+    const auto ids = itsGrantValues.slice(grant.values);
+    if (std::binary_search(ids.begin(), ids.end(), valueId))
+      return AccessStatus::GRANT;
+  }
+
+  if ((grant.flags & PATTERNS) != 0 && matchesPattern(grant, value))
+    return AccessStatus::GRANT;
+
+  return AccessStatus::DENY;
+}
+
+bool ServiceIndex::matchesPattern(const Grant& grant, std::string_view value) const
+{
+  // The last prefix not after the value is the only candidate, since no granted prefix
+  // begins with another one
+  const auto prefixes = itsGrantPrefixes.slice(grant.prefixes);
+  if (!prefixes.empty())
+  {
+    const auto* it = std::upper_bound(
+        prefixes.begin(), prefixes.end(), value, [this](std::string_view str, std::uint32_t id) {
+          return str < itsPrefixes.at(id);
+        });
+    if (it != prefixes.begin())
+    {
+      const auto prefix = itsPrefixes.at(*(it - 1));
+      if (value.substr(0, prefix.size()) == prefix)
+        return true;
+    }
+  }
+
+  // The last range starting at or below the value is the only candidate, since the ranges
+  // are disjoint
+  const auto ranges = itsGrantRanges.slice(grant.ranges);
+  std::int64_t number = 0;
+  if (!ranges.empty() && parseInteger(value, number))
+  {
+    const auto* it = std::upper_bound(
+        ranges.begin(), ranges.end(), number, [this](std::int64_t num, std::uint32_t id) {
+          return num < itsRanges[id].lo;
+        });
+    if (it != ranges.begin() && number <= itsRanges[*(it - 1)].hi)
+      return true;
+  }
+
+  return false;
+}
+
+AccessStatus ServiceIndex::resolveUnexpired(const Grant& grant,
+                                            std::string_view value,
+                                            bool explicitGrantOnly,
+                                            std::int64_t now) const
+{
+  // Expiry times are always stored when grant.expires is set
+  const auto expiries = itsExpiries.slice(grant.expiries);
+
+  if (!explicitGrantOnly && (grant.flags & WILDCARD) != 0 && expiries[0] > now)
+    return AccessStatus::WILDCARD_GRANT;
+
+  const auto tokens = itsGrantTokens.slice(grant.tokens);
+  const auto valueId = itsValues.find(value);
+  bool defined = false;
+  for (std::size_t i = 0; i < tokens.size(); i++)
+  {
+    if (expiries[i + 1] <= now)
+      continue;
+
+    const auto values = itsValueIds.slice(itsTokenValues[tokens[i]]);
+    if (values.empty())
+      continue;
+    defined = true;
+
+    if (valueId != StringTable::npos && std::binary_search(values.begin(), values.end(), valueId))
+      return AccessStatus::GRANT;
+
+    if ((grant.flags & PATTERNS) != 0)
+      for (const auto id : values)
+        if (matchesValue(itsValues.at(id), value))
+          return AccessStatus::GRANT;
+  }
+
+  // Same as with no grants at all
+  if (!defined)
+    return explicitGrantOnly ? AccessStatus::DENY : AccessStatus::UNKNOWN_APIKEY;
+
+  return AccessStatus::DENY;
+}
+
+std::int64_t ServiceIndex::validUntil(std::string_view apikey, std::string_view token) const
+{
+  const auto apikeyId = itsApikeys.find(apikey);
+  if (apikeyId == StringTable::npos)
+    return NO_EXPIRY;
+
+  const auto& grant = itsGrants[apikeyId];
+  if (grant.expiries.count == 0)
+    return NO_EXPIRY;
+  const auto expiries = itsExpiries.slice(grant.expiries);
+
+  if (token == WILDCARD_IDENTIFIER)
+    return ((grant.flags & WILDCARD) != 0 ? expiries[0] : NO_EXPIRY);
+
+  const auto tokenId = itsTokens.find(token);
+  const auto tokens = itsGrantTokens.slice(grant.tokens);
+  const auto* it = std::lower_bound(tokens.begin(), tokens.end(), tokenId);
+  if (tokenId == StringTable::npos || it == tokens.end() || *it != tokenId)
+    return NO_EXPIRY;
+  return expiries[static_cast<std::size_t>(it - tokens.begin()) + 1];
+}
+
+std::map<std::pair<std::string, std::string>, std::int64_t> ServiceIndex::expiries() const
+{
+  try
+  {
+    std::map<std::pair<std::string, std::string>, std::int64_t> ret;
+    for (std::uint32_t apikeyId = 0; apikeyId < itsApikeys.size(); apikeyId++)
+    {
+      const auto& grant = itsGrants[apikeyId];
+      if (grant.expiries.count == 0)
+        continue;
+
+      const std::string apikey(itsApikeys.at(apikeyId));
+      const auto expiries = itsExpiries.slice(grant.expiries);
+      if ((grant.flags & WILDCARD) != 0 && expiries[0] != NO_EXPIRY)
+        ret.emplace(std::make_pair(apikey, WILDCARD_IDENTIFIER), expiries[0]);
+
+      const auto tokens = itsGrantTokens.slice(grant.tokens);
+      for (std::size_t i = 0; i < tokens.size(); i++)
+        if (expiries[i + 1] != NO_EXPIRY)
+          ret.emplace(std::make_pair(apikey, std::string(itsTokens.at(tokens[i]))),
+                      expiries[i + 1]);
+    }
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("Service",
+                                                                       std::string(itsName));
+  }
+}
+
+std::vector<std::string> ServiceIndex::grantedTokens(std::string_view apikey) const
+{
+  try
+  {
+    std::vector<std::string> ret;
+    const auto apikeyId = itsApikeys.find(apikey);
+    if (apikeyId != StringTable::npos)
+    {
+      if ((itsGrants[apikeyId].flags & WILDCARD) != 0)
+        ret.push_back(WILDCARD_IDENTIFIER);
+      for (const auto tokenId : itsGrantTokens.slice(itsGrants[apikeyId].tokens))
+        if (itsTokenValues[tokenId].count > 0)
+          ret.emplace_back(itsTokens.at(tokenId));
+    }
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+ServiceData ServiceIndex::data() const
+{
+  try
+  {
+    ServiceData ret;
+
+    for (std::uint32_t tokenId = 0; tokenId < itsTokens.size(); tokenId++)
+    {
+      const auto valueIds = itsValueIds.slice(itsTokenValues[tokenId]);
+      if (valueIds.empty())
+        continue;
+      auto& values = ret.tokens[std::string(itsTokens.at(tokenId))];
+      for (const auto valueId : valueIds)
+        values.emplace(itsValues.at(valueId));
+    }
+
+    for (std::uint32_t apikeyId = 0; apikeyId < itsApikeys.size(); apikeyId++)
+    {
+      const auto& grant = itsGrants[apikeyId];
+      auto& tokens = ret.apikeys[std::string(itsApikeys.at(apikeyId))];
+      if ((grant.flags & WILDCARD) != 0)
+        tokens.insert(WILDCARD_IDENTIFIER);
+      for (const auto tokenId : itsGrantTokens.slice(grant.tokens))
+        tokens.emplace(itsTokens.at(tokenId));
+    }
+
+    ret.expiries = expiries();
+
+    return ret;
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("Service",
+                                                                       std::string(itsName));
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,285 @@
+#pragma once
+
+#include "FlatImage.h"
+#include <limits>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// Token name which grants access to all token values of a service
+const std::string WILDCARD_IDENTIFIER = "*";
+
+// Expiry time of grants which never expire
+const std::int64_t NO_EXPIRY = std::numeric_limits<std::int64_t>::max();
+
+// Default false positive rate of the apikey filters
+const double DEFAULT_APIKEY_FILTER_RATE = 0.01;
+
+// Options for building service indexes
+struct IndexOptions
+{
+  // False positive rate of the apikey filter, zero disables the filter
+  double apikeyFilterRate = DEFAULT_APIKEY_FILTER_RATE;
+
+  // Token values of form "lo..hi" also grant the integers in the range, and values of form
+  // "prefix*" also grant all values starting with the prefix
+  bool patternValues = false;
+};
+
+// Enum to signify access resolution status
+enum class AccessStatus : std::uint8_t
+{
+  WILDCARD_GRANT,
+  GRANT,
+  DENY,
+  UNKNOWN_APIKEY
+};
+
+// Authorization definitions of a single service as read from the database
+struct ServiceData
+{
+  // Token name -> token values
+  std::map<std::string, std::set<std::string>> tokens;
+
+  // Apikey -> granted token names, possibly including the wildcard
+  std::map<std::string, std::set<std::string>> apikeys;
+
+  // (apikey, token) -> valid_until in epoch seconds, for the grants which expire
+  std::map<std::pair<std::string, std::string>, std::int64_t> expiries;
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Immutable authorization index of a single service
+ *
+ * Apikeys, token names and token values are interned into dense integer
+ * ids stored in open addressing hash tables, and the grants are stored
+ * as id arrays in contiguous memory. All data lives in one position
+ * independent image.
+ *
+ * The token sets of each apikey are flattened into one sorted set of
+ * value ids at build time, hence a grant check is a single binary search
+ * regardless of the number of tokens granted. Tokens are referred to by
+ * id, and identical id lists are stored only once.
+ *
+ * A Bloom filter of the apikeys rejects most unknown apikeys without
+ * probing the apikey table.
+ *
+ * Optionally token values may also be integer ranges or prefixes. The
+ * ranges of each apikey are merged into sorted disjoint intervals, and
+ * its prefixes into a sorted set in which no prefix begins with another.
+ * Both are then matched with a binary search.
+ *
+ * Grants may expire. Each apikey stores the earliest expiry time of its
+ * grants, and only once that has passed are the grants resolved token by
+ * token, skipping the expired ones. Expired grants are dropped for good
+ * by building a new index without them.
+ */
+// ----------------------------------------------------------------------
+
+class ServiceIndex
+{
+ public:
+  struct Statistics
+  {
+    std::size_t apikeys = 0;
+    std::size_t tokens = 0;
+    std::size_t values = 0;
+    std::size_t imageSize = 0;    // bytes
+    std::size_t sharedBytes = 0;  // bytes saved by sharing identical id lists
+    std::size_t filterBytes = 0;  // bytes used by apikey filters
+    std::size_t expiringApikeys = 0;  // apikeys with grants which expire
+  };
+
+  // ----------------------------------------------------------------------
+  /*!
+   * \brief Builds an index in linear time from rows in any order
+   *
+   * Strings are interned into ids as the rows arrive, and only the id lists
+   * of each token and apikey need to be sorted when the image is built.
+   */
+  // ----------------------------------------------------------------------
+
+  class Builder
+  {
+   public:
+    explicit Builder(std::string name, const IndexOptions& options = IndexOptions())
+        : itsName(std::move(name)), itsOptions(options)
+    {
+    }
+
+    const std::string& name() const { return itsName; }
+
+    // Row of the token table
+    void addTokenValue(const std::string& token, const std::string& value);
+
+    // Row of the authorization table. Of duplicate rows the one valid the longest is used.
+    void addGrant(const std::string& apikey,
+                  const std::string& token,
+                  std::int64_t validUntil = NO_EXPIRY);
+
+    std::shared_ptr<const ServiceIndex> build() const;
+
+   private:
+    using IdMap = std::unordered_map<std::string, std::uint32_t>;
+
+    static std::uint32_t intern(IdMap& ids,
+                                std::vector<std::string_view>& strings,
+                                const std::string& str);
+
+    std::string itsName;
+    IndexOptions itsOptions;
+
+    // The string views refer to the keys of the maps, which are stable
+    IdMap itsApikeyIds;
+    IdMap itsTokenIds;
+    IdMap itsValueIds;
+    std::vector<std::string_view> itsApikeys;
+    std::vector<std::string_view> itsTokens;
+    std::vector<std::string_view> itsValues;
+
+    std::vector<std::vector<std::uint32_t>> itsTokenValues;  // token id -> value ids
+    std::vector<std::vector<std::uint32_t>> itsGrants;       // apikey id -> token ids
+    std::vector<std::vector<std::int64_t>> itsGrantExpiries;  // same for valid_until
+    std::vector<std::int64_t> itsWildcards;  // apikey id -> wildcard valid_until, 0 if none
+  };
+
+  // Build an image from the given definitions
+  static std::shared_ptr<const ServiceIndex> build(const std::string& name,
+                                                   const ServiceData& data,
+                                                   const IndexOptions& options = IndexOptions());
+
+  // Construct a view to an image, the storage keeps the image alive
+  ServiceIndex(std::shared_ptr<const void> storage, const char* image, std::size_t size);
+
+  std::string_view name() const { return itsName; }
+
+  const Statistics& statistics() const { return itsStatistics; }
+
+  // The raw image, for writing it to disk
+  ArrayView<char> image() const { return itsImage; }
+
+  AccessStatus resolveAccess(std::string_view apikey,
+                             std::string_view value,
+                             bool explicitGrantOnly = false) const;
+
+  // Id of the apikey in this index, StringTable::npos if the apikey is not defined
+  std::uint32_t findApikey(std::string_view apikey) const
+  {
+    return findApikey(apikey, hashString(apikey));
+  }
+
+  // Same with a precomputed hashString(apikey)
+  std::uint32_t findApikey(std::string_view apikey, std::uint64_t hash) const
+  {
+    return (itsApikeyFilter.mayContain(hash) ? itsApikeys.find(apikey, hash) : StringTable::npos);
+  }
+
+  std::string_view apikey(std::uint32_t id) const { return itsApikeys.at(id); }
+
+  // The false positive rate the apikey filter was built for, zero if there is no filter
+  double apikeyFilterRate() const { return itsApikeyFilterRate; }
+
+  // Same as resolveAccess for an apikey id returned by findApikey
+  AccessStatus resolveAccessById(std::uint32_t apikeyId,
+                                 std::string_view value,
+                                 bool explicitGrantOnly = false) const;
+
+  // Earliest expiry time of the grants of an apikey id, NO_EXPIRY if none expire
+  std::int64_t expires(std::uint32_t apikeyId) const
+  {
+    return (apikeyId == StringTable::npos ? NO_EXPIRY : itsGrants[apikeyId].expires);
+  }
+
+  // Expiry time of a single grant, NO_EXPIRY if the grant does not exist or never expires
+  std::int64_t validUntil(std::string_view apikey, std::string_view token) const;
+
+  // The grants which expire, for scheduling their removal
+  std::map<std::pair<std::string, std::string>, std::int64_t> expiries() const;
+
+  // Names of the tokens granted to the apikey, for diagnostics only
+  std::vector<std::string> grantedTokens(std::string_view apikey) const;
+
+  // True if the service has authorization rows, otherwise it is treated as an unknown service
+  bool isDefined() const { return itsApikeys.size() > 0; }
+
+  // Decode the definitions back from the index, for incremental updates
+  ServiceData data() const;
+
+ private:
+  struct Header;
+
+  enum GrantFlags : std::uint32_t
+  {
+    WILDCARD = 1,
+    DEFINED_TOKENS = 2,  // at least one granted token has values
+    PATTERNS = 4         // ranges or prefixes are granted
+  };
+
+  // Grants of a single apikey
+  struct Grant
+  {
+    std::uint32_t flags;
+    std::uint32_t reserved;
+    PoolRange tokens;    // range in itsGrantTokens
+    PoolRange values;    // range in itsGrantValues, union of the values of all tokens
+    PoolRange ranges;    // range in itsGrantRanges
+    PoolRange prefixes;  // range in itsGrantPrefixes
+    PoolRange expiries;  // range in itsExpiries, empty if no grant expires
+    std::int64_t expires;  // earliest expiry time of the grants
+  };
+
+  // Inclusive range of integers
+  struct ValueRange
+  {
+    std::int64_t lo;
+    std::int64_t hi;
+  };
+
+  // Match the granted ranges and prefixes
+  bool matchesPattern(const Grant& grant, std::string_view value) const;
+
+  // Resolve access token by token ignoring the grants expired by the given time
+  AccessStatus resolveUnexpired(const Grant& grant,
+                                std::string_view value,
+                                bool explicitGrantOnly,
+                                std::int64_t now) const;
+
+  std::shared_ptr<const void> itsStorage;
+  ArrayView<char> itsImage;
+
+  std::string_view itsName;
+
+  Statistics itsStatistics;
+
+  StringTable itsApikeys;
+  StringTable itsValues;
+  StringTable itsTokens;
+  StringTable itsPrefixes;  // ids are in lexicographic order
+  BloomFilter itsApikeyFilter;
+  double itsApikeyFilterRate = 0;
+
+  ArrayView<PoolRange> itsTokenValues;      // token id -> range in itsValueIds
+  ArrayView<std::uint32_t> itsValueIds;     // sorted value id lists
+  ArrayView<Grant> itsGrants;               // apikey id -> grants
+  ArrayView<std::uint32_t> itsGrantTokens;  // token id lists
+  ArrayView<std::uint32_t> itsGrantValues;  // sorted value id lists
+  ArrayView<ValueRange> itsRanges;          // distinct ranges sorted by their bounds
+  ArrayView<std::uint32_t> itsGrantRanges;  // sorted ids of disjoint ranges
+  ArrayView<std::uint32_t> itsGrantPrefixes;  // sorted prefix id lists
+  ArrayView<std::int64_t> itsExpiries;  // valid_until of the wildcard and of each granted token
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
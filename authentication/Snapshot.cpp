@@ -0,0 +1,464 @@
+#include "Snapshot.h"
+#include <macgyver/Exception.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <ctime>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+namespace
+{
+const std::uint32_t FILE_MAGIC = 0x50414E53;  // "SNAP"
+const std::uint32_t FILE_VERSION = 1;
+
+// Snapshot file layout: header, service image locations, service images
+struct FileHeader
+{
+  std::uint32_t magic;
+  std::uint32_t version;
+  std::int64_t created;    // epoch seconds
+  std::uint64_t checksum;  // of everything after the header
+  std::uint64_t services;
+};
+
+// Companion file recording when the contents of the snapshot file were last found current
+std::string checkedFilename(const std::string& filename)
+{
+  return filename + ".checked";
+}
+
+// Time of the last check of the snapshot with the given checksum, zero if unknown
+std::int64_t checkedTime(const std::string& filename, std::uint64_t checksum)
+{
+  std::ifstream in(checkedFilename(filename));
+  std::uint64_t checkedChecksum = 0;
+  std::int64_t checked = 0;
+  if (!(in >> checkedChecksum >> checked) || checkedChecksum != checksum)
+    return 0;
+  return checked;
+}
+
+// Read-only shared memory mapping of a file
+class MappedFile
+{
+ public:
+  explicit MappedFile(const std::string& filename)
+  {
+    const int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw Fmi::Exception(BCP, "Failed to open snapshot file");
+
+    struct stat st
+    {
+    };
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+      ::close(fd);
+      throw Fmi::Exception(BCP, "Failed to stat snapshot file");
+    }
+
+    itsSize = static_cast<std::size_t>(st.st_size);
+    void* ptr = ::mmap(nullptr, itsSize, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // the mapping keeps the file open
+    if (ptr == MAP_FAILED)
+      throw Fmi::Exception(BCP, "Failed to map snapshot file");
+    itsData = static_cast<const char*>(ptr);
+  }
+
+  ~MappedFile() { ::munmap(const_cast<char*>(itsData), itsSize); }
+
+  MappedFile(const MappedFile& other) = delete;
+  MappedFile& operator=(const MappedFile& other) = delete;
+  MappedFile(MappedFile&& other) = delete;
+  MappedFile& operator=(MappedFile&& other) = delete;
+
+  const char* data() const { return itsData; }
+  std::size_t size() const { return itsSize; }
+
+ private:
+  const char* itsData = nullptr;
+  std::size_t itsSize = 0;
+};
+
+}  // namespace
+
+std::uint32_t Snapshot::nextGeneration()
+{
+  static std::atomic<std::uint32_t> counter{0};
+  std::uint32_t generation = 0;
+  while (generation == 0)
+    generation = ++counter;
+  return generation;
+}
+
+Snapshot::Snapshot(std::vector<std::shared_ptr<const ServiceIndex>> services)
+    : itsServices(std::move(services))
+{
+  try
+  {
+    std::vector<std::string_view> names;
+    names.reserve(itsServices.size());
+    for (const auto& service : itsServices)
+    {
+      names.push_back(service->name());
+      itsLookup.push_back(service->isDefined() ? service.get() : nullptr);
+    }
+
+    ImageWriter writer(0);
+    const auto sections = StringTable::write(writer, names);
+    const auto size = writer.size();
+    itsNameImage = writer.release();
+    itsNames = StringTable(reinterpret_cast<const char*>(itsNameImage->data()), size, sections);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+ServiceIndex::Statistics Snapshot::statistics() const
+{
+  ServiceIndex::Statistics ret;
+  for (const auto& service : itsServices)
+  {
+    const auto& stats = service->statistics();
+    ret.apikeys += stats.apikeys;
+    ret.tokens += stats.tokens;
+    ret.values += stats.values;
+    ret.imageSize += stats.imageSize;
+    ret.sharedBytes += stats.sharedBytes;
+    ret.filterBytes += stats.filterBytes;
+    ret.expiringApikeys += stats.expiringApikeys;
+  }
+  return ret;
+}
+
+SnapshotBuilder::SnapshotBuilder(const Snapshot& base, const IndexOptions& options)
+    : itsOptions(options)
+{
+  try
+  {
+    for (const auto& service : base.services())
+      itsIndexes.emplace(std::string(service->name()), service);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+ServiceData& SnapshotBuilder::modify(const std::string& service)
+{
+  auto it = itsServices.find(service);
+  if (it != itsServices.end())
+    return it->second;
+
+  // Copy the definitions of an unmodified or finished service on first modification
+  auto& data = itsServices[service];
+  auto base = itsIndexes.find(service);
+  if (base != itsIndexes.end())
+  {
+    data = base->second->data();
+    itsIndexes.erase(base);
+  }
+  return data;
+}
+
+void Snapshot::write(const std::string& filename) const
+{
+  try
+  {
+    std::vector<ImageSection> directory;
+    std::uint64_t offset = sizeof(FileHeader) + itsServices.size() * sizeof(ImageSection);
+    for (const auto& service : itsServices)
+    {
+      const auto size = service->image().size();
+      directory.push_back(ImageSection{offset, size});
+      offset += (size + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t) * sizeof(std::uint64_t);
+    }
+
+    // Assemble the contents after the header for the checksum
+    std::string contents(offset - sizeof(FileHeader), '\0');
+    std::memcpy(contents.data(), directory.data(), directory.size() * sizeof(ImageSection));
+    for (std::size_t i = 0; i < itsServices.size(); i++)
+    {
+      const auto image = itsServices[i]->image();
+      std::memcpy(contents.data() + directory[i].offset - sizeof(FileHeader),
+                  image.data(),
+                  image.size());
+    }
+
+    FileHeader header{};
+    header.magic = FILE_MAGIC;
+    header.version = FILE_VERSION;
+    header.created = std::time(nullptr);
+    header.checksum = hashString(contents);
+    header.services = itsServices.size();
+
+    // Write to a temporary file and rename it so that readers never see a partial file.
+    // The file is never modified in place, since other processes may have it mapped.
+    const std::string tmpfile = filename + "." + std::to_string(::getpid()) + ".tmp";
+    {
+      std::ofstream out(tmpfile, std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+      out.close();
+      if (out.fail())
+        throw Fmi::Exception(BCP, "Failed to write snapshot file").addParameter("File", tmpfile);
+    }
+    std::filesystem::rename(tmpfile, filename);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("File", filename);
+  }
+}
+
+std::unique_ptr<const Snapshot> Snapshot::read(const std::string& filename,
+                                               int maxAgeSeconds,
+                                               bool mapped)
+{
+  try
+  {
+    std::shared_ptr<const void> storage;
+    const char* data = nullptr;
+    std::size_t size = 0;
+
+    if (mapped)
+    {
+      // Processes mapping the same file share its pages through the page cache
+      auto file = std::make_shared<const MappedFile>(filename);
+      data = file->data();
+      size = file->size();
+      storage = file;
+    }
+    else
+    {
+      std::ifstream in(filename, std::ios::binary | std::ios::ate);
+      if (!in)
+        throw Fmi::Exception(BCP, "Failed to open snapshot file");
+      size = static_cast<std::size_t>(in.tellg());
+
+      auto buffer = std::make_shared<ImageBuffer>((size + sizeof(std::uint64_t) - 1) /
+                                                  sizeof(std::uint64_t));
+      in.seekg(0);
+      in.read(reinterpret_cast<char*>(buffer->data()), static_cast<std::streamsize>(size));
+      if (!in)
+        throw Fmi::Exception(BCP, "Failed to read snapshot file");
+      data = reinterpret_cast<const char*>(buffer->data());
+      storage = buffer;
+    }
+
+    if (size < sizeof(FileHeader))
+      throw Fmi::Exception(BCP, "Snapshot file is truncated");
+
+    FileHeader header{};
+    std::memcpy(&header, data, sizeof(header));
+    if (header.magic != FILE_MAGIC || header.version != FILE_VERSION)
+      throw Fmi::Exception(BCP, "Snapshot file version mismatch");
+    const auto checked = std::max(header.created, checkedTime(filename, header.checksum));
+    if (std::time(nullptr) - checked > maxAgeSeconds)
+      throw Fmi::Exception(BCP, "Snapshot file is too old");
+    if (hashString(std::string_view(data + sizeof(header), size - sizeof(header))) !=
+        header.checksum)
+      throw Fmi::Exception(BCP, "Snapshot file checksum mismatch");
+
+    const ImageSection directorySection{sizeof(FileHeader), header.services};
+    const auto directory = imageArray<ImageSection>(data, size, directorySection);
+
+    // The service indexes refer directly to the loaded or mapped file, no deserialization
+    std::vector<std::shared_ptr<const ServiceIndex>> services;
+    for (const auto& section : directory)
+    {
+      if (section.offset % sizeof(std::uint64_t) != 0)
+        throw Fmi::Exception(BCP, "Misaligned service image in snapshot file");
+      const auto image = imageArray<char>(data, size, section);
+      services.push_back(std::make_shared<const ServiceIndex>(storage, image.data(), image.size()));
+    }
+    return std::make_unique<const Snapshot>(std::move(services));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("File", filename);
+  }
+}
+
+void Snapshot::markChecked(const std::string& filename)
+{
+  try
+  {
+    FileHeader header{};
+    {
+      std::ifstream in(filename, std::ios::binary);
+      in.read(reinterpret_cast<char*>(&header), sizeof(header));
+      if (!in || header.magic != FILE_MAGIC)
+        throw Fmi::Exception(BCP, "Failed to read snapshot file header");
+    }
+
+    const auto checked = checkedFilename(filename);
+    const std::string tmpfile = checked + "." + std::to_string(::getpid()) + ".tmp";
+    {
+      std::ofstream out(tmpfile, std::ios::trunc);
+      out << header.checksum << ' ' << static_cast<std::int64_t>(std::time(nullptr)) << '\n';
+      out.close();
+      if (out.fail())
+        throw Fmi::Exception(BCP, "Failed to write file").addParameter("File", tmpfile);
+    }
+    std::filesystem::rename(tmpfile, checked);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!").addParameter("File", filename);
+  }
+}
+
+std::string Snapshot::fileVersion(const std::string& filename)
+{
+  struct stat st
+  {
+  };
+  if (::stat(filename.c_str(), &st) != 0)
+    return {};
+  return std::to_string(st.st_ino) + ':' + std::to_string(st.st_mtim.tv_sec) + '.' +
+         std::to_string(st.st_mtim.tv_nsec) + ':' + std::to_string(st.st_size);
+}
+
+void SnapshotBuilder::addTokenValue(const std::string& service,
+                                    const std::string& token,
+                                    const std::string& value)
+{
+  try
+  {
+    modify(service).tokens[token].insert(value);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void SnapshotBuilder::removeTokenValue(const std::string& service,
+                                       const std::string& token,
+                                       const std::string& value)
+{
+  try
+  {
+    auto& tokens = modify(service).tokens;
+    auto it = tokens.find(token);
+    if (it == tokens.end())
+      return;
+    it->second.erase(value);
+    if (it->second.empty())
+      tokens.erase(it);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void SnapshotBuilder::addGrant(const std::string& apikey,
+                               const std::string& service,
+                               const std::string& token,
+                               std::int64_t validUntil)
+{
+  try
+  {
+    auto& data = modify(service);
+    const bool added = data.apikeys[apikey].insert(token).second;
+
+    // Of duplicate rows the one valid the longest is used
+    const auto key = std::make_pair(apikey, token);
+    auto expiry = data.expiries.find(key);
+    if (!added && expiry == data.expiries.end())
+      return;
+    if (validUntil == NO_EXPIRY)
+    {
+      if (expiry != data.expiries.end())
+        data.expiries.erase(expiry);
+    }
+    else if (expiry == data.expiries.end())
+      data.expiries.emplace(key, validUntil);
+    else
+      expiry->second = std::max(expiry->second, validUntil);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void SnapshotBuilder::removeGrant(const std::string& apikey,
+                                  const std::string& service,
+                                  const std::string& token)
+{
+  try
+  {
+    auto& data = modify(service);
+    auto& apikeys = data.apikeys;
+    auto it = apikeys.find(apikey);
+    if (it == apikeys.end())
+      return;
+    it->second.erase(token);
+    data.expiries.erase(std::make_pair(apikey, token));
+    if (it->second.empty())
+      apikeys.erase(it);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+void SnapshotBuilder::finish(const std::string& service)
+{
+  try
+  {
+    auto it = itsServices.find(service);
+    if (it == itsServices.end())
+      return;
+    if (!it->second.apikeys.empty() || !it->second.tokens.empty())
+      itsIndexes[service] = ServiceIndex::build(service, it->second, itsOptions);
+    itsServices.erase(it);
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+std::unique_ptr<const Snapshot> SnapshotBuilder::build() const
+{
+  try
+  {
+    std::vector<std::shared_ptr<const ServiceIndex>> services;
+    for (const auto& service : itsIndexes)
+      services.push_back(service.second);
+
+    for (const auto& service : itsServices)
+    {
+      // Services with token definitions only are kept for later incremental updates
+      if (!service.second.apikeys.empty() || !service.second.tokens.empty())
+        services.push_back(ServiceIndex::build(service.first, service.second, itsOptions));
+    }
+    return std::make_unique<const Snapshot>(std::move(services));
+  }
+  catch (...)
+  {
+    throw Fmi::Exception::Trace(BCP, "Operation failed!");
+  }
+}
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
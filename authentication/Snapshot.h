@@ -0,0 +1,159 @@
+#pragma once
+
+#include "ServiceIndex.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Immutable set of service authorization indexes
+ *
+ * A snapshot is never modified once built, new data is published by
+ * building a new snapshot.
+ */
+// ----------------------------------------------------------------------
+
+class Snapshot
+{
+ public:
+  Snapshot() = default;
+  explicit Snapshot(std::vector<std::shared_ptr<const ServiceIndex>> services);
+
+  // Returns nullptr for unknown services
+  const ServiceIndex* find(std::string_view service) const
+  {
+    const auto id = itsNames.find(service);
+    return (id == StringTable::npos ? nullptr : itsLookup[id]);
+  }
+
+  // Id of the service in this snapshot, StringTable::npos for unknown services
+  std::uint32_t findId(std::string_view service) const { return itsNames.find(service); }
+
+  // Returns nullptr for unknown services
+  const ServiceIndex* findById(std::uint32_t id) const
+  {
+    return (id == StringTable::npos ? nullptr : itsLookup[id]);
+  }
+
+  // Id of the apikey in the index of a service of this snapshot, StringTable::npos if unknown.
+  // The apikey filter of the service rejects most unknown apikeys.
+  std::uint32_t findApikey(const ServiceIndex& index, std::string_view apikey) const
+  {
+    return index.findApikey(apikey);
+  }
+
+  // Returns the index even if the service has no authorization rows
+  std::shared_ptr<const ServiceIndex> get(std::string_view service) const
+  {
+    const auto id = itsNames.find(service);
+    return (id == StringTable::npos ? nullptr : itsServices[id]);
+  }
+
+  const std::vector<std::shared_ptr<const ServiceIndex>>& services() const { return itsServices; }
+
+  // Identifies the snapshot uniquely within the process, never zero. Ids found in a snapshot
+  // are valid only in the snapshot with the same generation.
+  std::uint32_t generation() const { return itsGeneration; }
+
+  // Totals over all services
+  ServiceIndex::Statistics statistics() const;
+
+  // Save the snapshot atomically to the given file
+  void write(const std::string& filename) const;
+
+  // Load a snapshot saved by write(). Throws if the file is corrupt or older than the given age,
+  // counted from the latest of the write and the last markChecked() of the same file contents.
+  // A mapped snapshot is queried directly from the memory mapped file.
+  static std::unique_ptr<const Snapshot> read(const std::string& filename,
+                                              int maxAgeSeconds,
+                                              bool mapped = false);
+
+  // Record that the data in the file was found to be current. Kept in a separate file, since
+  // the snapshot file is never modified in place.
+  static void markChecked(const std::string& filename);
+
+  // Identity of the current generation of the file, changes when a new one is renamed over it
+  static std::string fileVersion(const std::string& filename);
+
+ private:
+  static std::uint32_t nextGeneration();
+
+  std::uint32_t itsGeneration = nextGeneration();
+  std::shared_ptr<const ImageBuffer> itsNameImage;
+  StringTable itsNames;
+  std::vector<std::shared_ptr<const ServiceIndex>> itsServices;
+  std::vector<const ServiceIndex*> itsLookup;  // nullptr for services which are not defined
+};
+
+// ----------------------------------------------------------------------
+/*!
+ * \brief Collects database rows and builds a snapshot out of them
+ *
+ * The builder may also start from an existing snapshot, in which case
+ * only the services modified by row changes are rebuilt, and the new
+ * snapshot shares the indexes of all other services with the old one.
+ *
+ * When the rows arrive ordered by service, each service can be finished
+ * as soon as its rows have been added, which keeps the memory needed for
+ * the row data down to a single service.
+ */
+// ----------------------------------------------------------------------
+
+class SnapshotBuilder
+{
+ public:
+  // The options apply to the services built
+  explicit SnapshotBuilder(const IndexOptions& options = IndexOptions()) : itsOptions(options) {}
+
+  explicit SnapshotBuilder(const Snapshot& base, const IndexOptions& options = IndexOptions());
+
+  // Row of the token table
+  void addTokenValue(const std::string& service,
+                     const std::string& token,
+                     const std::string& value);
+  void removeTokenValue(const std::string& service,
+                        const std::string& token,
+                        const std::string& value);
+
+  // Row of the authorization table
+  void addGrant(const std::string& apikey,
+                const std::string& service,
+                const std::string& token,
+                std::int64_t validUntil = NO_EXPIRY);
+  void removeGrant(const std::string& apikey,
+                   const std::string& service,
+                   const std::string& token);
+
+  // Number of services which need to be rebuilt
+  std::size_t modifiedCount() const { return itsServices.size(); }
+
+  // Build the index of a service whose rows have all been added, releasing its row data
+  void finish(const std::string& service);
+
+  std::unique_ptr<const Snapshot> build() const;
+
+ private:
+  ServiceData& modify(const std::string& service);
+
+  IndexOptions itsOptions;
+
+  // Service name -> Service definition for new or modified services
+  std::map<std::string, ServiceData> itsServices;
+
+  // Service name -> Service index for unmodified and finished services
+  std::map<std::string, std::shared_ptr<const ServiceIndex>> itsIndexes;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace SmartMet
+{
+namespace Engine
+{
+namespace Authentication
+{
+// ----------------------------------------------------------------------
+/*!
+ * \brief Atomically published pointer to an immutable snapshot
+ *
+ * Readers pick up the current snapshot with a single atomic load inside a
+ * read-side critical section, whose only cost is an increment of a counter
+ * in a per-thread shard. Readers never block each other nor the writer.
+ *
+ * The writer publishes a new snapshot with a single atomic exchange and
+ * then waits for a grace period (RCU style): the reader epoch is flipped,
+ * and once every reader registered under the previous epochs has left,
+ * nobody can hold the old snapshot anymore and it is destroyed.
+ */
+// ----------------------------------------------------------------------
+
+template <typename T>
+class SnapshotPointer
+{
+ private:
+  static constexpr std::size_t ShardCount = 64;
+
+  // One cache line per shard to avoid false sharing between reader threads
+  struct alignas(64) Shard
+  {
+    std::atomic<std::size_t> readers[2] = {{0}, {0}};
+  };
+
+ public:
+  // Read-side critical section. The snapshot stays valid while the guard is alive.
+  class ReadGuard
+  {
+   public:
+    ReadGuard(const ReadGuard& other) = delete;
+    ReadGuard& operator=(const ReadGuard& other) = delete;
+    ReadGuard& operator=(ReadGuard&& other) = delete;
+
+    ReadGuard(ReadGuard&& other) noexcept : itsCounter(other.itsCounter), itsValue(other.itsValue)
+    {
+      other.itsCounter = nullptr;
+    }
+
+    ~ReadGuard()
+    {
+      if (itsCounter)
+        itsCounter->fetch_sub(1);
+    }
+
+    const T* get() const { return itsValue; }
+    const T& operator*() const { return *itsValue; }
+    const T* operator->() const { return itsValue; }
+
+   private:
+    friend class SnapshotPointer;
+
+    ReadGuard(std::atomic<std::size_t>* counter, const T* value)
+        : itsCounter(counter), itsValue(value)
+    {
+    }
+
+    std::atomic<std::size_t>* itsCounter;
+    const T* itsValue;
+  };
+
+  SnapshotPointer() = default;
+
+  ~SnapshotPointer() { delete itsValue.load(); }
+
+  SnapshotPointer(const SnapshotPointer& other) = delete;
+  SnapshotPointer& operator=(const SnapshotPointer& other) = delete;
+  SnapshotPointer(SnapshotPointer&& other) = delete;
+  SnapshotPointer& operator=(SnapshotPointer&& other) = delete;
+
+  // Enter a read-side critical section and fetch the current snapshot
+  ReadGuard read() const
+  {
+    // All operations are sequentially consistent, which the grace period logic relies on
+    auto& shard = itsShards[shardIndex()];
+    auto* counter = &shard.readers[itsEpoch.load() & 1U];
+    counter->fetch_add(1);
+    return ReadGuard(counter, itsValue.load());
+  }
+
+  // Publish a new snapshot and destroy the previous one once no reader can see it
+  void publish(std::unique_ptr<const T> value)
+  {
+    std::lock_guard<std::mutex> lock(itsWriteMutex);
+    std::unique_ptr<const T> old(itsValue.exchange(value.release()));
+    synchronize();
+  }
+
+ private:
+  // Wait until no reader can hold a snapshot published before this call. Each phase flips
+  // the epoch and waits for the readers counted under the previous one. Two phases are needed,
+  // since a reader may read the epoch just before a flip but register itself under it only
+  // after the corresponding wait has completed.
+  void synchronize()
+  {
+    for (int phase = 0; phase < 2; phase++)
+    {
+      const unsigned previous = itsEpoch.fetch_add(1) & 1U;
+      for (const auto& shard : itsShards)
+      {
+        while (shard.readers[previous].load() != 0)
+          std::this_thread::yield();
+      }
+    }
+  }
+
+  // Threads are assigned to shards round robin on first use
+  static std::size_t shardIndex()
+  {
+    static std::atomic<std::size_t> next{0};
+    thread_local const std::size_t index = next.fetch_add(1) % ShardCount;
+    return index;
+  }
+
+  mutable std::array<Shard, ShardCount> itsShards;
+
+  std::atomic<unsigned> itsEpoch{0};
+
+  std::atomic<const T*> itsValue{nullptr};
+
+  std::mutex itsWriteMutex;
+};
+
+}  // namespace Authentication
+}  // namespace Engine
+}  // namespace SmartMet
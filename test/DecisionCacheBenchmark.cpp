@@ -0,0 +1,166 @@
+// Measures whether the decision cache pays off. Synthetic data, no database needed.
+//
+// Usage: DecisionCacheBenchmark [threads] [lookups per thread]
+
+#include "DecisionCache.h"
+#include "Snapshot.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+struct Query
+{
+  std::string service;
+  std::string apikey;
+  std::string value;
+};
+
+// Services with apikeys granted random subsets of tokens
+std::unique_ptr<const Snapshot> makeSnapshot(int services, int apikeys, int tokens, int values)
+{
+  std::mt19937 rng(42);
+  SnapshotBuilder builder;
+  for (int s = 0; s < services; s++)
+  {
+    const auto service = "service" + std::to_string(s);
+    for (int t = 0; t < tokens; t++)
+      for (int v = 0; v < values; v++)
+        builder.addTokenValue(service,
+                              "token" + std::to_string(t),
+                              "value" + std::to_string((t * values + v) % (tokens * values / 2)));
+    for (int a = 0; a < apikeys; a++)
+      for (int g = 0; g < 3; g++)
+        builder.addGrant("apikey" + std::to_string(a),
+                         service,
+                         "token" + std::to_string(static_cast<int>(rng() % tokens)));
+    builder.finish(service);
+  }
+  return builder.build();
+}
+
+// Zipf distributed picks: a few apikeys and values make up most of the traffic
+std::vector<Query> makeQueries(
+    std::size_t count, int services, int apikeys, int values, double skew, unsigned seed)
+{
+  auto zipf = [skew](int n) {
+    std::vector<double> weights;
+    for (int i = 1; i <= n; i++)
+      weights.push_back(1.0 / std::pow(i, skew));
+    return std::discrete_distribution<int>(weights.begin(), weights.end());
+  };
+
+  std::mt19937 rng(seed);
+  auto pickService = zipf(services);
+  auto pickApikey = zipf(apikeys * 2);  // half of the apikeys are unknown
+  auto pickValue = zipf(values);
+
+  std::vector<Query> ret;
+  ret.reserve(count);
+  for (std::size_t i = 0; i < count; i++)
+    ret.push_back(Query{"service" + std::to_string(pickService(rng)),
+                        "apikey" + std::to_string(pickApikey(rng)),
+                        "value" + std::to_string(pickValue(rng))});
+  return ret;
+}
+
+bool resolve(const Snapshot& snapshot, const Query& q)
+{
+  const auto* index = snapshot.find(q.service);
+  if (!index)
+    return true;
+  return index->resolveAccess(q.apikey, q.value) != AccessStatus::DENY;
+}
+
+// Nanoseconds per lookup over all threads
+double run(const Snapshot& snapshot,
+           const DecisionCache* cache,
+           const std::vector<std::vector<Query>>& queries,
+           std::size_t lookups)
+{
+  std::atomic<std::size_t> allowed{0};
+  std::vector<std::thread> threads;
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto& q : queries)
+    threads.emplace_back([&]() {
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < lookups; i++)
+      {
+        const auto& query = q[i % q.size()];
+        if (cache)
+          n += cache->find(snapshot.generation(),
+                           query.service,
+                           query.apikey,
+                           query.value,
+                           false,
+                           [&]() {
+                             return DecisionCache::Decision{resolve(snapshot, query), NO_EXPIRY};
+                           })
+                   .allowed;
+        else
+          n += resolve(snapshot, query);
+      }
+      allowed += n;
+    });
+  for (auto& t : threads)
+    t.join();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / lookups;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  const int maxThreads = (argc > 1 ? std::atoi(argv[1]) : 4);
+  const std::size_t lookups = (argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000000);
+
+  std::cout << "apikeys,skew,threads,cache_entries,ns_per_lookup,hit_ratio\n";
+
+  for (int apikeys : {100, 100000})
+  {
+    const int services = 10;
+    const int tokens = 50;
+    const int values = 200;
+    const auto snapshot = makeSnapshot(services, apikeys, tokens, values);
+
+    for (double skew : {0.0, 1.0, 1.5})
+    {
+      for (int threads = 1; threads <= maxThreads; threads *= 2)
+      {
+        std::vector<std::vector<Query>> queries;
+        for (int t = 0; t < threads; t++)
+          queries.push_back(makeQueries(100000, services, apikeys, tokens * values / 2, skew, t));
+
+        for (std::size_t entries : {0, 1024, 16384})
+        {
+          std::unique_ptr<DecisionCache> cache;
+          if (entries > 0)
+            cache = std::make_unique<DecisionCache>(entries);
+
+          const auto before = (cache ? cache->statistics() : DecisionCache::Statistics());
+          const double ns = run(*snapshot, cache.get(), queries, lookups);
+          const auto after = (cache ? cache->statistics() : DecisionCache::Statistics());
+
+          const double hits = static_cast<double>(after.hits - before.hits);
+          const double total = hits + static_cast<double>(after.misses - before.misses);
+          std::cout << apikeys << ',' << skew << ',' << threads << ',' << entries << ','
+                    << std::fixed << std::setprecision(1) << ns << ',' << std::setprecision(3)
+                    << (total > 0 ? hits / total : 0.0) << std::defaultfloat << '\n';
+        }
+      }
+    }
+  }
+  return 0;
+}
@@ -4,8 +4,37 @@
 #include <spine/Options.h>
 #include <spine/Reactor.h>
 
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+
 using namespace std;
 
+// Heap allocations are counted while enabled, to verify that authorization does not allocate
+std::atomic<bool> count_allocations{false};
+std::atomic<std::size_t> allocation_count{0};
+
+void *operator new(std::size_t size)
+{
+  if (count_allocations)
+    ++allocation_count;
+  if (void *ptr = std::malloc(size > 0 ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept
+{
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+  std::free(ptr);
+}
+
 std::shared_ptr<SmartMet::Engine::Authentication::Engine> authengine;
 std::string apikey = "testkey";
 std::string apikey2 = "testkey2";
@@ -119,6 +148,190 @@ void access_denied()
   TEST_PASSED();
 }
 
+void access_handles()
+{
+  std::vector<std::string> values = {"value1", "value2", "value3"};
+
+  const auto service = authengine->resolveService("testservice");
+  const auto key = authengine->resolveApikey(service, apikey);
+  const auto key2 = authengine->resolveApikey(service, apikey2);
+
+  // Same results as with names, also when a handle is used repeatedly
+  for (int i = 0; i < 2; i++)
+  {
+    if (!authengine->authorize(key, "value1"))
+      TEST_FAILED("No access to 'value1' token value with handles");
+
+    if (authengine->authorize(key2, "value1"))
+      TEST_FAILED("Incorrectly granted access to 'value1' token value with handles");
+
+    if (!authengine->authorize(key, values))
+      TEST_FAILED("No access to valueset 'value1,value2,value3' with handles");
+
+    if (authengine->authorize(key2, values))
+      TEST_FAILED("Incorrectly granted access to valueset 'value1,value2,value3' with handles");
+  }
+
+  const auto unknown = authengine->resolveService("nonexistent_service");
+  if (!authengine->authorize(authengine->resolveApikey(unknown, apikey), "value1"))
+    TEST_FAILED("Incorrectly no access to 'nonexistent_service' service with handles");
+
+  // The apikey handle keeps a copy of the service handle
+  const auto copied = authengine->resolveApikey(authengine->resolveService("testservice"), apikey);
+  if (!authengine->authorize(copied, "value1"))
+    TEST_FAILED("No access to 'value1' with a handle of a temporary service handle");
+
+  bool failed = false;
+  try
+  {
+    authengine->authorize(SmartMet::Engine::Authentication::ApikeyHandle(), "value1");
+  }
+  catch (...)
+  {
+    failed = true;
+  }
+  if (!failed)
+    TEST_FAILED("Authorizing with a default constructed apikey handle should fail");
+
+  TEST_PASSED();
+}
+
+void access_each()
+{
+  std::vector<std::string> values = {"value1", "value4", "value2", "value3"};
+
+  const auto service = authengine->resolveService("testservice");
+
+  // Must agree with single value calls
+  for (const auto &key : {apikey, apikey2, apikey_wildcard, std::string("foobar")})
+  {
+    const auto verdicts = authengine->authorizeEach(key, values, "testservice");
+    const auto handle_verdicts =
+        authengine->authorizeEach(authengine->resolveApikey(service, key), values);
+    if (verdicts.size() != values.size() || handle_verdicts != verdicts)
+      TEST_FAILED("Wrong number of verdicts for apikey '" + key + "'");
+
+    for (std::size_t i = 0; i < values.size(); i++)
+      if (verdicts[i] != authengine->authorize(key, values[i], "testservice"))
+        TEST_FAILED("Verdict mismatch for apikey '" + key + "' and value '" + values[i] + "'");
+  }
+
+  const auto verdicts = authengine->authorizeEach(apikey, values, "nonexistent_service");
+  if (verdicts != std::vector<bool>(values.size(), true))
+    TEST_FAILED("Incorrectly no access to 'nonexistent_service' service");
+
+  TEST_PASSED();
+}
+
+void access_batch()
+{
+  const std::vector<std::string> keys = {apikey, apikey2, apikey_wildcard, "foobar"};
+  const std::vector<std::string> services = {"testservice", "testservice2", "nonexistent_service"};
+  const std::vector<std::string> values = {"value1", "value2", "value3", "value4"};
+
+  std::vector<SmartMet::Engine::Authentication::AuthorizationRequest> requests;
+  for (const auto &service : services)
+    for (const auto &key : keys)
+      for (const auto &value : values)
+        for (bool explicit_only : {false, true})
+          requests.push_back({key, service, value, explicit_only});
+
+  // Reversed order too, the results must not depend on the previous requests
+  std::vector<SmartMet::Engine::Authentication::AuthorizationRequest> reversed(requests.rbegin(),
+                                                                             requests.rend());
+
+  for (const auto &batch : {requests, reversed})
+  {
+    const auto results = authengine->authorizeBatch(batch);
+    if (results.size() != batch.size())
+      TEST_FAILED("Wrong number of batch results");
+
+    for (std::size_t i = 0; i < batch.size(); i++)
+    {
+      const auto &r = batch[i];
+      const bool expected =
+          authengine->authorize(r.apikey, r.tokenvalue, r.service, r.explicitGrantOnly);
+      if (results[i] != expected)
+        TEST_FAILED("Batch result differs from single value result for apikey '" +
+                    std::string(r.apikey) + "', service '" + std::string(r.service) +
+                    "' and value '" + std::string(r.tokenvalue) + "'");
+    }
+  }
+
+  if (!authengine->authorizeBatch({}).empty())
+    TEST_FAILED("Empty batch should produce no results");
+
+  TEST_PASSED();
+}
+
+void generation()
+{
+  // The data loaded at startup has been taken into use
+  const auto generation = authengine->generation();
+  if (generation == 0)
+    TEST_FAILED("Generation should be positive after initialization");
+
+  const auto id1 = authengine->subscribe([](std::uint64_t) {});
+  const auto id2 = authengine->subscribe([](std::uint64_t) {});
+  if (id1 == id2)
+    TEST_FAILED("Subscriptions should have distinct ids");
+  authengine->unsubscribe(id1);
+  authengine->unsubscribe(id2);
+
+  if (authengine->generation() < generation)
+    TEST_FAILED("Generation should never decrease");
+
+  TEST_PASSED();
+}
+
+void unlimited_quota()
+{
+  // No quota table is configured, hence nobody is limited
+  for (int i = 0; i < 1000; i++)
+    if (!authengine->consume(apikey, "testservice"))
+      TEST_FAILED("Request refused without a quota");
+
+  TEST_PASSED();
+}
+
+void update_metrics()
+{
+  // The initial load is recorded even though the call metrics are disabled
+  const auto metrics = authengine->metrics();
+  if (metrics.enabled)
+    TEST_FAILED("Metrics should be disabled by default");
+  if (metrics.rebuild.successes == 0 || metrics.rebuild.kind != "full")
+    TEST_FAILED("Initial load not recorded");
+  if (metrics.rebuild.services == 0 || metrics.rebuild.rows == 0)
+    TEST_FAILED("Sizes of the initial load not recorded");
+
+  TEST_PASSED();
+}
+
+void no_allocations()
+{
+  const std::string_view key = apikey;
+  const std::array<std::string_view, 3> values = {"value1", "value2", "value3"};
+  const auto service = authengine->resolveService("testservice");
+  const auto handle = authengine->resolveApikey(service, apikey);
+
+  allocation_count = 0;
+  count_allocations = true;
+  const bool has_access = (authengine->authorize(key, "value1", "testservice") &&
+                           authengine->authorize(key, values, "testservice") &&
+                           !authengine->authorize("foobar", "value1", "testservice") &&
+                           authengine->authorize(handle, "value1") &&
+                           authengine->authorize(handle, values));
+  count_allocations = false;
+
+  if (!has_access)
+    TEST_FAILED("Incorrect results with string views");
+  if (allocation_count > 0)
+    TEST_FAILED("Authorization allocated memory " + std::to_string(allocation_count) + " times");
+
+  TEST_PASSED();
+}
+
 // Test driver
 class tests : public tframe::tests
 {
@@ -132,6 +345,13 @@ class tests : public tframe::tests
     TEST(access_denied);
     TEST(access_wildcard);
     TEST(unknown_apikey);
+    TEST(access_handles);
+    TEST(access_each);
+    TEST(access_batch);
+    TEST(generation);
+    TEST(unlimited_quota);
+    TEST(update_metrics);
+    TEST(no_allocations);
   }
 
 };  // class tests
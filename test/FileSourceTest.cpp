@@ -0,0 +1,179 @@
+// Tests of reading the CSV files of the file source with the fixtures in the data directory:
+// quoted fields, CRLF line endings, comment and blank lines, and rejection of malformed rows.
+// No database needed.
+//
+// Usage: FileSourceTest [fixture directory]
+
+#include "DataSource.h"
+#include "FileSource.h"
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, const std::string& name)
+{
+  if (!ok)
+  {
+    std::cout << "FAILED: " << name << '\n';
+    failures++;
+  }
+}
+
+// Records the rows passed by the source
+class RecordingSink : public RowSink
+{
+ public:
+  void tokenValue(const std::string& service,
+                  const std::string& token,
+                  const std::string& value) override
+  {
+    tokens.push_back(TokenRow{service, token, value});
+  }
+
+  void grant(const std::string& apikey,
+             const std::string& service,
+             const std::string& token,
+             std::int64_t validUntil) override
+  {
+    grants.push_back(GrantRow{apikey, service, token, validUntil});
+  }
+
+  void finish(const std::string& service) override { (void)service; }
+
+  void service(std::shared_ptr<const ServiceIndex> index) override { (void)index; }
+
+  std::vector<TokenRow> tokens;
+  std::vector<GrantRow> grants;
+};
+
+bool loadFails(const std::string& tokenFile, const std::string& grantFile)
+{
+  try
+  {
+    FileSource source(tokenFile, grantFile, "");
+    RecordingSink sink;
+    source.load(sink);
+    return false;
+  }
+  catch (...)
+  {
+    return true;
+  }
+}
+
+bool quotasFail(const std::string& tokenFile,
+                const std::string& grantFile,
+                const std::string& quotaFile)
+{
+  try
+  {
+    FileSource source(tokenFile, grantFile, quotaFile);
+    QuotaData quotas;
+    source.quotas(quotas);
+    return false;
+  }
+  catch (...)
+  {
+    return true;
+  }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  const std::string dir = (argc > 1 ? argv[1] : "data");
+  const auto tokenFile = dir + "/tokens.csv";
+  const auto grantFile = dir + "/grants.csv";
+  const auto quotaFile = dir + "/quotas.csv";
+
+  try
+  {
+    FileSource source(tokenFile, grantFile, quotaFile);
+    RecordingSink sink;
+    source.load(sink);
+
+    // Comment and blank lines are skipped, CR of CRLF line endings is dropped
+    const std::vector<std::string> values{"temperature", "a,b", "say \"hello\"", "windspeed", ""};
+    check(sink.tokens.size() == values.size(), "number of token rows");
+    for (std::size_t i = 0; i < sink.tokens.size() && i < values.size(); i++)
+    {
+      check(sink.tokens[i].service == "service", "service of token row " + std::to_string(i));
+      check(sink.tokens[i].value == values[i], "value '" + values[i] + "'");
+    }
+    if (sink.tokens.size() == values.size())
+    {
+      check(sink.tokens[1].token == "quoted", "quoted token name");
+      check(sink.tokens[3].token == "crlf", "token name of a CRLF line");
+    }
+
+    // An omitted or empty valid_until never expires
+    const std::vector<std::int64_t> expiry{NO_EXPIRY, NO_EXPIRY, 4102444800, 1700000000, NO_EXPIRY};
+    check(sink.grants.size() == expiry.size(), "number of grant rows");
+    for (std::size_t i = 0; i < sink.grants.size() && i < expiry.size(); i++)
+      check(sink.grants[i].validUntil == expiry[i],
+            "valid_until of grant row " + std::to_string(i) + " is " + std::to_string(expiry[i]));
+    if (sink.grants.size() == expiry.size())
+    {
+      check(sink.grants[3].apikey == "key, quoted", "quoted apikey with a comma");
+      check(sink.grants[2].token == "escaped", "token name before a CRLF line ending");
+    }
+
+    // The grants with no expiry are granted
+    IndexSink index(IndexOptions{});
+    source.load(index);
+    const auto snapshot = index.build();
+    const auto* service = snapshot->find("service");
+    check(service != nullptr, "service is built");
+    if (service)
+    {
+      const auto apikey = snapshot->findApikey(*service, "key");
+      check(service->resolveAccessById(apikey, "temperature") == AccessStatus::GRANT,
+            "grant without valid_until");
+      check(service->resolveAccessById(apikey, "a,b") == AccessStatus::GRANT,
+            "grant with an empty valid_until");
+      check(service->resolveAccessById(apikey, "windspeed") == AccessStatus::DENY,
+            "value of another apikey");
+    }
+
+    QuotaData quotas;
+    check(source.quotas(quotas), "quota file is read");
+    check(quotas.size() == 2, "number of quota rows");
+    check(quotas[std::make_pair("service", "key")] == (QuotaLimit{1.5, 10}),
+          "quota with a CRLF line ending");
+    check(quotas[std::make_pair("service", "key, quoted")] == (QuotaLimit{0, 0}),
+          "quota of a quoted apikey");
+
+    QuotaData none;
+    check(!FileSource(tokenFile, grantFile, "").quotas(none), "no quota file");
+  }
+  catch (...)
+  {
+    check(false, "reading valid files");
+  }
+
+  // Malformed files
+  check(loadFails(dir + "/tokens_fields.csv", grantFile), "token row with too many fields");
+  check(loadFails(tokenFile, dir + "/grants_fields.csv"), "grant row with too few fields");
+  check(loadFails(tokenFile, dir + "/grants_time.csv"), "malformed valid_until");
+  check(loadFails(tokenFile, dir + "/grants_quote.csv"), "unterminated quoted field");
+  check(loadFails(tokenFile, dir + "/missing.csv"), "missing file");
+  check(quotasFail(tokenFile, grantFile, dir + "/quotas_number.csv"), "malformed quota rate");
+
+  if (failures > 0)
+  {
+    std::cout << "FileSourceTest FAILED\n";
+    return 1;
+  }
+  std::cout << "FileSourceTest passed\n";
+  return 0;
+}
@@ -0,0 +1,414 @@
+// Throughput and latency of authorization lookups on large synthetic datasets, measured the
+// way the engine performs them. No database needed.
+//
+// Usage: LookupBenchmark [name=value ...]
+//
+//   apikeys=100000          apikeys in total
+//   services=100            services, their popularity is Zipf distributed
+//   services_per_apikey=2   services each apikey is granted tokens of
+//   tokens=50               tokens per service
+//   values=20               values per token
+//   grants=3                tokens granted per apikey and service
+//   wildcard=0.05           fraction of apikeys with a wildcard grant
+//   unknown=0.1             fraction of queries with an unknown apikey
+//   granted=0.9             fraction of values picked from the tokens granted to the apikey
+//   skew=1.0                Zipf exponent of the apikeys queried, zero for uniform
+//   multi=8                 values per multi-value query
+//   threads=<cores>         maximum number of threads, doubled from one
+//   lookups=1000000         queries per thread
+//   format=csv              csv or json, one record per line
+//
+// Each lookup resolves the service, the apikey and the values from scratch. One lookup in
+// 64 is timed individually for the latency percentiles.
+
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+  std::map<std::string, std::string> values;
+
+  double get(const std::string& name, double defaultValue) const
+  {
+    const auto pos = values.find(name);
+    return (pos == values.end() ? defaultValue : std::atof(pos->second.c_str()));
+  }
+  std::string get(const std::string& name, const std::string& defaultValue) const
+  {
+    const auto pos = values.find(name);
+    return (pos == values.end() ? defaultValue : pos->second);
+  }
+};
+
+struct Dataset
+{
+  int apikeys;
+  int services;
+  int servicesPerApikey;
+  int tokens;
+  int values;
+  int grants;
+  double wildcard;
+
+  // Token number g granted to the apikey for the service
+  int grantedToken(int apikey, int service, int g) const
+  {
+    std::uint64_t h = (static_cast<std::uint64_t>(apikey) << 32) ^
+                      (static_cast<std::uint64_t>(service) << 8) ^ static_cast<std::uint64_t>(g);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return static_cast<int>(h % static_cast<std::uint64_t>(tokens));
+  }
+};
+
+struct Query
+{
+  std::string service;
+  std::string apikey;
+  std::vector<std::string> values;
+};
+
+std::string serviceName(int s)
+{
+  return "service" + std::to_string(s);
+}
+std::string apikeyName(int a)
+{
+  return "apikey" + std::to_string(a);
+}
+std::string tokenName(int t)
+{
+  return "token" + std::to_string(t);
+}
+std::string valueName(int t, int v)
+{
+  return "value" + std::to_string(t) + "_" + std::to_string(v);
+}
+
+std::discrete_distribution<int> zipf(int n, double skew)
+{
+  std::vector<double> weights;
+  for (int i = 1; i <= n; i++)
+    weights.push_back(1.0 / std::pow(i, skew));
+  return std::discrete_distribution<int>(weights.begin(), weights.end());
+}
+
+// Services of each apikey, popular services having more apikeys
+std::vector<std::vector<int>> assignServices(const Dataset& data)
+{
+  std::mt19937 rng(42);
+  auto pickService = zipf(data.services, 1.0);
+  std::vector<std::vector<int>> ret(data.apikeys);
+  for (auto& services : ret)
+  {
+    while (static_cast<int>(services.size()) < std::min(data.servicesPerApikey, data.services))
+    {
+      const int s = pickService(rng);
+      if (std::find(services.begin(), services.end(), s) == services.end())
+        services.push_back(s);
+    }
+  }
+  return ret;
+}
+
+// Built service by service as the engine does when loading the tables
+std::unique_ptr<const Snapshot> makeSnapshot(const Dataset& data,
+                                             const std::vector<std::vector<int>>& apikeyServices,
+                                             const std::vector<bool>& wildcards)
+{
+  std::vector<std::vector<int>> serviceApikeys(data.services);
+  for (int a = 0; a < data.apikeys; a++)
+    for (int s : apikeyServices[a])
+      serviceApikeys[s].push_back(a);
+
+  SnapshotBuilder builder;
+  for (int s = 0; s < data.services; s++)
+  {
+    const auto service = serviceName(s);
+    for (int t = 0; t < data.tokens; t++)
+      for (int v = 0; v < data.values; v++)
+        builder.addTokenValue(service, tokenName(t), valueName(t, v));
+    for (int a : serviceApikeys[s])
+    {
+      const auto apikey = apikeyName(a);
+      if (wildcards[a])
+        builder.addGrant(apikey, service, WILDCARD_IDENTIFIER);
+      else
+        for (int g = 0; g < data.grants; g++)
+          builder.addGrant(apikey, service, tokenName(data.grantedToken(a, s, g)));
+    }
+    builder.finish(service);
+  }
+  return builder.build();
+}
+
+// Queries of apikeys picked by the given distribution, some of them unknown
+template <typename Pick>
+std::vector<Query> makeQueries(const Dataset& data,
+                               const std::vector<std::vector<int>>& apikeyServices,
+                               Pick&& pickApikey,
+                               int valuesPerQuery,
+                               double unknown,
+                               double granted,
+                               unsigned seed)
+{
+  std::mt19937 rng(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+
+  std::vector<Query> ret(65536);
+  for (auto& query : ret)
+  {
+    const int a = pickApikey(rng);
+    const auto& services = apikeyServices[a];
+    const int s = services[rng() % services.size()];
+    query.service = serviceName(s);
+    query.apikey = (uniform(rng) < unknown ? "unknown" + std::to_string(a) : apikeyName(a));
+    for (int i = 0; i < valuesPerQuery; i++)
+    {
+      const int t =
+          (uniform(rng) < granted ? data.grantedToken(a, s, static_cast<int>(rng() % data.grants))
+                                  : static_cast<int>(rng() % data.tokens));
+      query.values.push_back(valueName(t, static_cast<int>(rng() % data.values)));
+    }
+  }
+  return ret;
+}
+
+// The engine's decision on all the values of a query
+bool lookup(const Snapshot& snapshot, const Query& query)
+{
+  const auto* index = snapshot.find(query.service);
+  if (!index)
+    return true;
+  const auto apikeyId = snapshot.findApikey(*index, query.apikey);
+  for (const auto& value : query.values)
+  {
+    switch (index->resolveAccessById(apikeyId, value))
+    {
+      case AccessStatus::GRANT:
+        continue;
+      case AccessStatus::WILDCARD_GRANT:
+        return true;
+      case AccessStatus::DENY:
+      case AccessStatus::UNKNOWN_APIKEY:
+        return false;
+    }
+  }
+  return true;
+}
+
+struct Result
+{
+  double nsPerLookup;
+  double lookupsPerSecond;
+  double p50;
+  double p99;
+  double p999;
+  double allowedRatio;
+};
+
+Result run(const Snapshot& snapshot,
+           const std::vector<std::vector<Query>>& queries,
+           std::size_t lookups)
+{
+  const std::size_t threadCount = queries.size();
+  std::vector<std::vector<std::int64_t>> samples(threadCount);
+  std::atomic<std::size_t> allowed{0};
+  std::atomic<std::size_t> ready{0};
+  std::atomic<bool> go{false};
+
+  std::vector<std::thread> threads;
+  for (std::size_t t = 0; t < threadCount; t++)
+    threads.emplace_back([&, t]() {
+      const auto& q = queries[t];
+      auto& latencies = samples[t];
+      latencies.reserve(lookups / 64 + 1);
+      ready++;
+      while (!go.load())
+        std::this_thread::yield();
+
+      std::size_t n = 0;
+      for (std::size_t i = 0; i < lookups; i++)
+      {
+        const auto& query = q[i % q.size()];
+        if (i % 64 != 0)
+        {
+          n += lookup(snapshot, query);
+          continue;
+        }
+        const auto start = Clock::now();
+        n += lookup(snapshot, query);
+        latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                Clock::now() - start)
+                                .count());
+      }
+      allowed += n;
+    });
+
+  while (ready.load() < threadCount)
+    std::this_thread::yield();
+  const auto start = Clock::now();
+  go = true;
+  for (auto& t : threads)
+    t.join();
+  const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<std::int64_t> all;
+  for (const auto& latencies : samples)
+    all.insert(all.end(), latencies.begin(), latencies.end());
+  std::sort(all.begin(), all.end());
+  auto percentile = [&all](double p) {
+    if (all.empty())
+      return 0.0;
+    const auto i = std::min(all.size() - 1, static_cast<std::size_t>(p * all.size()));
+    return static_cast<double>(all[i]);
+  };
+
+  const double total = static_cast<double>(lookups * threadCount);
+  return Result{1e9 * seconds / static_cast<double>(lookups),
+                total / seconds,
+                percentile(0.5),
+                percentile(0.99),
+                percentile(0.999),
+                static_cast<double>(allowed.load()) / total};
+}
+
+void print(const std::string& format,
+           const std::string& benchmark,
+           const Dataset& data,
+           std::size_t threads,
+           std::size_t lookups,
+           const Result& result)
+{
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  if (format == "json")
+    out << "{\"benchmark\":\"" << benchmark << "\",\"apikeys\":" << data.apikeys
+        << ",\"services\":" << data.services << ",\"tokens\":" << data.tokens
+        << ",\"values\":" << data.values << ",\"threads\":" << threads
+        << ",\"lookups\":" << lookups << ",\"ns_per_lookup\":" << result.nsPerLookup
+        << ",\"lookups_per_second\":" << result.lookupsPerSecond
+        << ",\"p50_ns\":" << result.p50 << ",\"p99_ns\":" << result.p99
+        << ",\"p999_ns\":" << result.p999 << ",\"allowed_ratio\":" << std::setprecision(3)
+        << result.allowedRatio << "}\n";
+  else
+    out << benchmark << ',' << data.apikeys << ',' << data.services << ',' << data.tokens << ','
+        << data.values << ',' << threads << ',' << lookups << ',' << result.nsPerLookup << ','
+        << result.lookupsPerSecond << ',' << result.p50 << ',' << result.p99 << ','
+        << result.p999 << ',' << std::setprecision(3) << result.allowedRatio << '\n';
+  std::cout << out.str() << std::flush;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    const auto pos = arg.find('=');
+    if (pos == std::string::npos)
+    {
+      std::cerr << "Invalid argument '" << arg << "', expected name=value\n";
+      return 1;
+    }
+    options.values[arg.substr(0, pos)] = arg.substr(pos + 1);
+  }
+
+  Dataset data;
+  data.apikeys = std::max(1, static_cast<int>(options.get("apikeys", 100000)));
+  data.services = std::max(1, static_cast<int>(options.get("services", 100)));
+  data.servicesPerApikey = std::max(1, static_cast<int>(options.get("services_per_apikey", 2)));
+  data.tokens = std::max(1, static_cast<int>(options.get("tokens", 50)));
+  data.values = std::max(1, static_cast<int>(options.get("values", 20)));
+  data.grants = std::max(1, static_cast<int>(options.get("grants", 3)));
+  data.wildcard = options.get("wildcard", 0.05);
+  const double unknown = options.get("unknown", 0.1);
+  const double granted = options.get("granted", 0.9);
+  const double skew = options.get("skew", 1.0);
+  const int multi = std::max(1, static_cast<int>(options.get("multi", 8)));
+  const int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  const int maxThreads = std::max(1, static_cast<int>(options.get("threads", cores)));
+  const auto lookups = static_cast<std::size_t>(std::max(1.0, options.get("lookups", 1e6)));
+  const auto format = options.get("format", std::string("csv"));
+
+  // Every wildcard apikey is picked at even intervals so that the datasets are reproducible
+  std::vector<bool> wildcards(data.apikeys, false);
+  std::vector<int> wildcardApikeys;
+  if (data.wildcard > 0)
+  {
+    const int step = std::max(1, static_cast<int>(std::lround(1 / data.wildcard)));
+    for (int a = 0; a < data.apikeys; a += step)
+    {
+      wildcards[a] = true;
+      wildcardApikeys.push_back(a);
+    }
+  }
+
+  const auto apikeyServices = assignServices(data);
+  const auto buildStart = Clock::now();
+  const auto snapshot = makeSnapshot(data, apikeyServices, wildcards);
+  const auto stats = snapshot->statistics();
+  std::cerr << "Built " << data.services << " services with " << stats.apikeys
+            << " apikeys in total in "
+            << std::chrono::duration<double>(Clock::now() - buildStart).count() << " s, "
+            << stats.imageSize + stats.filterBytes << " bytes\n";
+
+  if (format != "json")
+    std::cout << "benchmark,apikeys,services,tokens,values,threads,lookups,ns_per_lookup,"
+                 "lookups_per_second,p50_ns,p99_ns,p999_ns,allowed_ratio\n";
+
+  auto pickAny = zipf(data.apikeys, skew);
+  std::uniform_int_distribution<std::size_t> pickWildcardIndex(
+      0, std::max<std::size_t>(wildcardApikeys.size(), 1) - 1);
+  auto pickWildcard = [&](std::mt19937& rng) { return wildcardApikeys[pickWildcardIndex(rng)]; };
+
+  for (const std::string benchmark : {"single", "multi", "wildcard"})
+  {
+    if (benchmark == "wildcard" && wildcardApikeys.empty())
+      continue;
+
+    for (int threads = 1; threads <= maxThreads; threads *= 2)
+    {
+      std::vector<std::vector<Query>> queries;
+      for (int t = 0; t < threads; t++)
+      {
+        const auto seed = static_cast<unsigned>(t + 1);
+        if (benchmark == "single")
+          queries.push_back(
+              makeQueries(data, apikeyServices, pickAny, 1, unknown, granted, seed));
+        else if (benchmark == "multi")
+          queries.push_back(
+              makeQueries(data, apikeyServices, pickAny, multi, unknown, granted, seed));
+        else
+          queries.push_back(
+              makeQueries(data, apikeyServices, pickWildcard, multi, 0, granted, seed));
+      }
+
+      print(format, benchmark, data, threads, lookups, run(*snapshot, queries, lookups));
+    }
+  }
+  return 0;
+}
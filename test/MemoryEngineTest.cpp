@@ -0,0 +1,165 @@
+// Tests of data changes with the in-memory source: setData swaps in new data on the next update
+// round, the generation increases and the subscribers are notified. No database needed.
+
+#include "Engine.h"
+#include <regression/tframe.h>
+
+#include <spine/Options.h>
+#include <spine/Reactor.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace std;
+
+std::shared_ptr<SmartMet::Engine::Authentication::Engine> authengine;
+
+using SmartMet::Engine::Authentication::GrantRow;
+using SmartMet::Engine::Authentication::TokenRow;
+
+namespace
+{
+// Counts the calls of a subscriber. Shared with the callback, which may still be called once
+// after it has been unsubscribed.
+struct Calls
+{
+  std::atomic<int> count{0};
+  std::atomic<std::uint64_t> generation{0};
+};
+
+std::size_t subscribe(const std::shared_ptr<Calls> &calls)
+{
+  return authengine->subscribe([calls](std::uint64_t generation) {
+    calls->generation = generation;
+    calls->count++;
+  });
+}
+
+// Wait for the update thread to take new data into use and notify the subscriber
+bool wait_for_call(const Calls &calls)
+{
+  for (int i = 0; i < 100; i++)
+  {
+    if (calls.count > 0)
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  return false;
+}
+
+std::vector<TokenRow> tokens(const std::string &value)
+{
+  return {TokenRow{"testservice", "token1", value}};
+}
+
+std::vector<GrantRow> grants()
+{
+  GrantRow grant;
+  grant.apikey = "testkey";
+  grant.service = "testservice";
+  grant.token = "token1";
+  return {grant};
+}
+}  // namespace
+
+namespace Tests
+{
+// ----------------------------------------------------------------------
+
+void initial_data()
+{
+  if (authengine->generation() == 0)
+    TEST_FAILED("Generation should be positive after initialization");
+
+  if (authengine->authorize("testkey", "value1", "testservice"))
+    TEST_FAILED("Access granted before any data was set");
+
+  TEST_PASSED();
+}
+
+void set_data()
+{
+  const auto calls = std::make_shared<Calls>();
+  const auto id = subscribe(calls);
+
+  const auto generation = authengine->generation();
+  authengine->setData(tokens("value1"), grants());
+  const bool updated = wait_for_call(*calls);
+  authengine->unsubscribe(id);
+  if (!updated)
+    TEST_FAILED("New data was not taken into use within 10 seconds");
+
+  if (calls->count != 1)
+    TEST_FAILED("Subscriber called " + std::to_string(calls->count.load()) +
+                " times instead of once");
+  if (calls->generation <= generation || calls->generation != authengine->generation())
+    TEST_FAILED("Subscriber should be called with the new generation");
+  if (!authengine->authorize("testkey", "value1", "testservice"))
+    TEST_FAILED("No access to 'value1' after setData");
+
+  TEST_PASSED();
+}
+
+void unsubscribe()
+{
+  const auto calls = std::make_shared<Calls>();
+  authengine->unsubscribe(subscribe(calls));
+
+  // A subscriber which stays subscribed shows when the update has been notified
+  const auto others = std::make_shared<Calls>();
+  const auto id = subscribe(others);
+
+  const auto generation = authengine->generation();
+  authengine->setData(tokens("value2"), grants());
+  const bool updated = wait_for_call(*others);
+  authengine->unsubscribe(id);
+  if (!updated)
+    TEST_FAILED("New data was not taken into use within 10 seconds");
+
+  if (others->generation <= generation)
+    TEST_FAILED("Subscriber should be called with the new generation");
+  if (calls->count != 0)
+    TEST_FAILED("Unsubscribed callback was called");
+  if (authengine->authorize("testkey", "value1", "testservice") ||
+      !authengine->authorize("testkey", "value2", "testservice"))
+    TEST_FAILED("Old data still in use after the update");
+
+  TEST_PASSED();
+}
+
+// Test driver
+class tests : public tframe::tests
+{
+  // Overridden message separator
+  virtual const char *error_message_prefix() const { return "\n\t"; }
+  // Main test suite
+  void test()
+  {
+    TEST(initial_data);
+    TEST(set_data);
+    TEST(unsubscribe);
+  }
+
+};  // class tests
+
+}  // namespace Tests
+
+int main(void)
+{
+  SmartMet::Spine::Options opts;
+  opts.configfile = "cnf/memory_reactor.conf";
+  opts.parseConfig();
+
+  SmartMet::Spine::Reactor reactor(opts);
+  reactor.init();
+  authengine = reactor.getEngine<SmartMet::Engine::Authentication::Engine>("Authentication", NULL);
+
+  cout << endl << "Memory source tester" << endl << "====================" << endl;
+  Tests::tests t;
+  auto result = t.run();
+  authengine.reset();
+  reactor.shutdown();
+  return result;
+}
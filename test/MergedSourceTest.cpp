@@ -0,0 +1,182 @@
+// Tests of merging several sources: precedence of services defined by several sources, prefixes,
+// and sources which do not respond. No database needed.
+//
+// Usage: MergedSourceTest [directory for the temporary files]
+
+#include "CoarseClock.h"
+#include "MergedSource.h"
+
+#include <sys/stat.h>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, const std::string& name)
+{
+  if (!ok)
+  {
+    std::cout << "FAILED: " << name << '\n';
+    failures++;
+  }
+}
+
+SourceConfig makeConfig(const std::string& name,
+                        const std::string& type,
+                        const std::string& prefix = "",
+                        const std::string& tokenFile = "",
+                        const std::string& grantFile = "")
+{
+  SourceConfig config;
+  config.name = name;
+  config.type = type;
+  config.prefix = prefix;
+  config.tokenFile = tokenFile;
+  config.grantFile = grantFile;
+  config.timeoutSeconds = 1;
+  return config;
+}
+
+// One update round, as run by the engine
+std::unique_ptr<const Snapshot> update(MergedSource& source)
+{
+  source.begin();
+  IndexSink sink(IndexOptions{});
+  source.load(sink);
+  source.end(true);
+  return sink.build();
+}
+
+bool granted(const Snapshot& snapshot,
+             const std::string& service,
+             const std::string& apikey,
+             const std::string& value)
+{
+  const auto* index = snapshot.find(service);
+  if (!index)
+    return false;
+  return index->resolveAccessById(snapshot.findApikey(*index, apikey), value) ==
+         AccessStatus::GRANT;
+}
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void writeFile(const std::string& filename, const std::string& contents)
+{
+  std::ofstream out(filename, std::ios::trunc);
+  out << contents;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  CoarseClock::update();
+
+  const std::string dir = (argc > 1 ? argv[1] : "/tmp");
+  const auto tokenFile = dir + "/MergedSourceTest_tokens.csv";
+  const auto grantFile = dir + "/MergedSourceTest_grants.csv";
+  const auto fifo = dir + "/MergedSourceTest_fifo";
+  writeFile(tokenFile, "shared,token,file value\nfileonly,token,file value\n");
+  writeFile(grantFile, "key,shared,token\nkey,fileonly,token\n");
+
+  try
+  {
+    MergedSource source(
+        {makeConfig("memory", "memory"), makeConfig("file", "file", "", tokenFile, grantFile),
+         makeConfig("prefixed", "file", "other/", tokenFile, grantFile)},
+        IndexOptions{});
+
+    // Token values without grants in the first source do not hide the grants of a later one
+    source.setData({TokenRow{"shared", "token", "memory value"}}, {});
+    auto snapshot = update(source);
+    check(granted(*snapshot, "shared", "key", "file value"),
+          "service without grants does not take precedence");
+    check(!granted(*snapshot, "shared", "key", "memory value"),
+          "token values of a service without grants are not used");
+
+    // A service with grants in the first source takes precedence
+    GrantRow grant;
+    grant.apikey = "key";
+    grant.service = "shared";
+    grant.token = "token";
+    source.setData({TokenRow{"shared", "token", "memory value"}}, {grant});
+    snapshot = update(source);
+    check(granted(*snapshot, "shared", "key", "memory value"), "first source takes precedence");
+    check(!granted(*snapshot, "shared", "key", "file value"), "later source is hidden");
+    check(granted(*snapshot, "fileonly", "key", "file value"), "service of a later source");
+    check(granted(*snapshot, "other/shared", "key", "file value"), "prefixed service");
+
+    // A service without grants in any source stays undefined
+    source.setData({TokenRow{"tokensonly", "token", "memory value"}}, {});
+    snapshot = update(source);
+    check(snapshot->find("tokensonly") == nullptr, "service without grants is undefined");
+    check(granted(*snapshot, "shared", "key", "file value"), "grants of a later source return");
+  }
+  catch (...)
+  {
+    check(false, "merging readable sources");
+  }
+
+  // A source which does not respond does not stop the updates, and the destruction waits for its
+  // read to finish
+  std::remove(fifo.c_str());
+  if (mkfifo(fifo.c_str(), 0600) != 0)
+    check(false, "creating a named pipe");
+  else
+  {
+    // Lets the hung read finish after the update round has timed out
+    std::thread writer([&fifo]() {
+      std::this_thread::sleep_for(std::chrono::seconds(2));
+      writeFile(fifo, "");
+    });
+
+    try
+    {
+      auto source = std::make_unique<MergedSource>(
+          std::vector<SourceConfig>{makeConfig("file", "file", "", tokenFile, grantFile),
+                                    makeConfig("hung", "file", "hung/", fifo, grantFile)},
+          IndexOptions{});
+
+      const auto start = std::chrono::steady_clock::now();
+      const auto snapshot = update(*source);
+      check(secondsSince(start) < 1.5, "update round waits only for the timeout");
+      check(granted(*snapshot, "shared", "key", "file value"), "responding source is served");
+      check(snapshot->find("hung/shared") == nullptr, "hung source has no data");
+
+      source.reset();
+      check(secondsSince(start) > 1.5, "destruction waits for the read in progress");
+    }
+    catch (...)
+    {
+      check(false, "merging with a hung source");
+    }
+
+    writer.join();
+    std::remove(fifo.c_str());
+  }
+
+  std::remove(tokenFile.c_str());
+  std::remove(grantFile.c_str());
+
+  if (failures > 0)
+  {
+    std::cout << "MergedSourceTest FAILED\n";
+    return 1;
+  }
+  std::cout << "MergedSourceTest passed\n";
+  return 0;
+}
@@ -0,0 +1,246 @@
+// Tests of range ("lo..hi") and prefix ("prefix*") token values. No database needed.
+//
+// Usage: PatternValueTest
+
+#include "CoarseClock.h"
+#include "ServiceIndex.h"
+
+#include <cstdint>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+int failures = 0;
+
+const std::string MIN = std::to_string(std::numeric_limits<std::int64_t>::min());
+const std::string MAX = std::to_string(std::numeric_limits<std::int64_t>::max());
+
+// Token values and the tokens granted to each apikey
+struct Definition
+{
+  std::vector<std::pair<std::string, std::string>> values;
+  std::vector<std::pair<std::string, std::string>> grants;
+};
+
+// Grants which never expire, grants which expire later, and grants resolved token by token
+// because another grant of the apikey has already expired
+enum class Expiry
+{
+  NEVER,
+  LATER,
+  EXPIRED
+};
+
+std::shared_ptr<const ServiceIndex> build(const Definition& definition,
+                                          bool patterns,
+                                          Expiry expiry)
+{
+  const auto now = static_cast<std::int64_t>(std::time(nullptr));
+  IndexOptions options;
+  options.patternValues = patterns;
+  ServiceIndex::Builder builder("service", options);
+  for (const auto& value : definition.values)
+    builder.addTokenValue(value.first, value.second);
+  for (const auto& grant : definition.grants)
+  {
+    builder.addGrant(grant.first, grant.second, expiry == Expiry::NEVER ? NO_EXPIRY : now + 3600);
+    if (expiry == Expiry::EXPIRED)
+      builder.addGrant(grant.first, "expired", now - 10);
+  }
+  builder.addTokenValue("expired", "expired value");
+  return builder.build();
+}
+
+bool granted(const ServiceIndex& index, const std::string& apikey, const std::string& value)
+{
+  return index.resolveAccessById(index.findApikey(apikey), value) == AccessStatus::GRANT;
+}
+
+// Check the verdicts of values for an apikey with all kinds of grants
+void expect(const Definition& definition,
+            const std::string& apikey,
+            const std::vector<std::pair<std::string, bool>>& expected,
+            const std::string& name,
+            bool patterns = true)
+{
+  for (const auto expiry : {Expiry::NEVER, Expiry::LATER, Expiry::EXPIRED})
+  {
+    const auto index = build(definition, patterns, expiry);
+    for (const auto& value : expected)
+    {
+      if (granted(*index, apikey, value.first) != value.second)
+      {
+        std::cout << "FAILED: " << name << ": value '" << value.first << "' should be "
+                  << (value.second ? "granted" : "denied")
+                  << (expiry == Expiry::NEVER
+                          ? ""
+                          : (expiry == Expiry::LATER ? " (expiring grants)" : " (expired grant)"))
+                  << '\n';
+        failures++;
+      }
+    }
+  }
+}
+
+}  // namespace
+
+int main()
+{
+  CoarseClock::update();
+
+  // Overlapping ranges of different tokens merge into one
+  expect({{{"a", "10..20"}, {"b", "15..30"}, {"c", "100..200"}}, {{"key", "a"}, {"key", "b"}}},
+         "key",
+         {{"9", false},
+          {"10", true},
+          {"17", true},
+          {"30", true},
+          {"31", false},
+          {"150", false}},
+         "overlapping ranges");
+
+  // Adjacent ranges merge, a gap of one does not
+  expect({{{"a", "1..5"}, {"a", "6..10"}, {"a", "12..14"}}, {{"key", "a"}}},
+         "key",
+         {{"0", false},
+          {"5", true},
+          {"6", true},
+          {"10", true},
+          {"11", false},
+          {"12", true},
+          {"14", true},
+          {"15", false}},
+         "adjacent ranges");
+
+  // A range contained in another one
+  expect({{{"a", "1..100"}, {"a", "20..30"}, {"a", "90..110"}}, {{"key", "a"}}},
+         "key",
+         {{"1", true}, {"25", true}, {"100", true}, {"110", true}, {"111", false}},
+         "contained ranges");
+
+  // The bounds of 64 bit integers
+  expect({{{"a", MIN + "..-5"}, {"a", "5.." + MAX}}, {{"key", "a"}}},
+         "key",
+         {{MIN, true},
+          {"-5", true},
+          {"-4", false},
+          {"0", false},
+          {"4", false},
+          {"5", true},
+          {MAX, true},
+          {"9223372036854775808", false},
+          {"-9223372036854775809", false}},
+         "64 bit bounds");
+  expect({{{"a", MIN + ".." + MAX}}, {{"key", "a"}}},
+         "key",
+         {{MIN, true}, {"0", true}, {MAX, true}, {"x", false}},
+         "full range");
+  expect({{{"a", MIN + ".." + MIN}, {"a", "-3..-3"}, {"a", MAX + ".." + MAX}}, {{"key", "a"}}},
+         "key",
+         {{MIN, true}, {"-9223372036854775807", false}, {"-3", true}, {MAX, true}},
+         "single value ranges at the bounds");
+
+  // Negative ranges, also merged across zero
+  expect({{{"a", "-20..-10"}, {"a", "-9..0"}, {"b", "-100..-50"}}, {{"key", "a"}, {"key", "b"}}},
+         "key",
+         {{"-21", false},
+          {"-20", true},
+          {"-10", true},
+          {"-9", true},
+          {"0", true},
+          {"1", false},
+          {"-75", true},
+          {"-49", false}},
+         "negative ranges");
+
+  // Only canonical integers match ranges
+  expect({{{"a", "0..200"}}, {{"key", "a"}}},
+         "key",
+         {{"7", true},
+          {"007", false},
+          {"+5", false},
+          {"0150", false},
+          {"-0", false},
+          {"00", false},
+          {"0", true},
+          {"1e2", false},
+          {" 5", false},
+          {"", false}},
+         "non-canonical integers");
+
+  // Ranges with non-canonical or reversed bounds are plain values
+  expect({{{"a", "007..9"}, {"a", "20..10"}}, {{"key", "a"}}},
+         "key",
+         {{"8", false}, {"15", false}, {"007..9", true}, {"20..10", true}},
+         "invalid ranges");
+
+  // Nested prefixes of different tokens
+  expect({{{"a", "ecmwf_*"}, {"b", "ecmwf_hres*"}, {"c", "gfs*"}}, {{"key", "a"}, {"key", "b"}}},
+         "key",
+         {{"ecmwf_", true},
+          {"ecmwf_ens", true},
+          {"ecmwf_hres", true},
+          {"ecmwf_hres_sfc", true},
+          {"ecmwf_z", true},
+          {"ecmwf", false},
+          {"ecmw", false},
+          {"gfs", false},
+          {"hirlam", false}},
+         "nested prefixes");
+  expect({{{"a", "ecmwf_*"}, {"b", "ecmwf_hres*"}}, {{"key", "b"}}},
+         "key",
+         {{"ecmwf_hres", true}, {"ecmwf_hres_sfc", true}, {"ecmwf_ens", false}, {"ecmwf_", false}},
+         "narrower prefix only");
+  expect({{{"a", "ab*"}, {"a", "abc*"}, {"a", "abd*"}, {"a", "b*"}}, {{"key", "a"}}},
+         "key",
+         {{"ab", true}, {"abcx", true}, {"abe", true}, {"aa", false}, {"bz", true}, {"c", false}},
+         "sibling prefixes");
+
+  // An empty prefix does not grant every value
+  expect({{{"a", "*"}, {"a", "**"}}, {{"key", "a"}}},
+         "key",
+         {{"*", true}, {"**", true}, {"*x", true}, {"x", false}, {"", false}},
+         "empty prefix");
+
+  // Plain values behave as before with patterns enabled, and patterns are plain values when
+  // they are disabled
+  const Definition plain{{{"a", "temperature"}, {"a", "10..20"}, {"a", "wind*"}, {"b", "x"}},
+                         {{"key", "a"}, {"other", "b"}}};
+  for (const bool patterns : {false, true})
+  {
+    const std::string mode = (patterns ? " with patterns" : " without patterns");
+    expect(plain,
+           "key",
+           {{"temperature", true},
+            {"temperatur", false},
+            {"temperature2", false},
+            {"x", false},
+            {"10..20", true},
+            {"wind*", true},
+            {"15", patterns},
+            {"windspeed", patterns}},
+           "plain values" + mode,
+           patterns);
+    expect(plain,
+           "other",
+           {{"x", true}, {"15", false}, {"windspeed", false}, {"temperature", false}},
+           "plain values of another apikey" + mode,
+           patterns);
+  }
+
+  if (failures > 0)
+  {
+    std::cout << "PatternValueTest FAILED\n";
+    return 1;
+  }
+  std::cout << "PatternValueTest passed\n";
+  return 0;
+}
@@ -0,0 +1,249 @@
+// Tests of reading the database: changelog rows committed out of order or rolled back, and the
+// probe for changed tables. Uses the database of cnf/authentication.conf, and creates and drops
+// tables of its own in its schema.
+//
+// Usage: PostgresSourceTest
+
+#include "Config.h"
+#include "PostgresSource.h"
+
+#include <macgyver/Exception.h>
+#include <macgyver/PostgreSQLConnection.h>
+
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, const std::string& name)
+{
+  if (!ok)
+  {
+    std::cout << "FAILED: " << name << '\n';
+    failures++;
+  }
+}
+
+const std::string TOKEN_TABLE = "pgsourcetest_tokens";
+const std::string AUTH_TABLE = "pgsourcetest_grants";
+const std::string CHANGELOG_TABLE = "pgsourcetest_changelog";
+
+std::unique_ptr<Fmi::Database::PostgreSQLConnection> connect(const SourceConfig& config)
+{
+  Fmi::Database::PostgreSQLConnectionOptions opt;
+  opt.host = config.dBHost;
+  opt.port = config.port;
+  opt.database = config.database;
+  opt.username = config.user;
+  opt.password = config.password;
+  return std::make_unique<Fmi::Database::PostgreSQLConnection>(opt);
+}
+
+// Token value inserted into the token table together with its changelog row
+void insertToken(const Fmi::Database::PostgreSQLConnection::Transaction& transaction,
+                 const std::string& schema,
+                 const std::string& value)
+{
+  transaction.execute("INSERT INTO " + schema + "." + TOKEN_TABLE +
+                      " VALUES ('service','token','" + value + "');");
+  transaction.execute("INSERT INTO " + schema + "." + CHANGELOG_TABLE +
+                      " (operation,table_name,service,token,value) VALUES ('insert','" +
+                      TOKEN_TABLE + "','service','token','" + value + "');");
+}
+
+// One update round as run by the engine. Returns the values of the changes read from the
+// changelog, and sets reloaded if the tables were read instead.
+std::set<std::string> update(PostgresSource& source, bool& reloaded)
+{
+  std::vector<RowChange> changes;
+  source.begin();
+  try
+  {
+    reloaded = !source.changes(changes);
+    if (reloaded)
+    {
+      IndexSink sink(IndexOptions{});
+      source.load(sink);
+      sink.build();
+    }
+    source.end(true);
+  }
+  catch (...)
+  {
+    source.end(false);
+    throw;
+  }
+
+  std::set<std::string> values;
+  for (const auto& change : changes)
+    values.insert(change.value);
+  return values;
+}
+
+// Version of the data in one round
+std::string version(PostgresSource& source)
+{
+  source.begin();
+  try
+  {
+    auto ret = source.version();
+    source.end(true);
+    return ret;
+  }
+  catch (...)
+  {
+    source.end(false);
+    throw;
+  }
+}
+
+}  // namespace
+
+int main()
+{
+  try
+  {
+    const Config config("cnf/authentication.conf");
+    auto sourceConfig = config.sources.front();
+    sourceConfig.tokenTable = TOKEN_TABLE;
+    sourceConfig.authTable = AUTH_TABLE;
+    sourceConfig.changelogTable = CHANGELOG_TABLE;
+    sourceConfig.quotaTable.clear();
+    sourceConfig.validUntilColumn.clear();
+    const auto& schema = sourceConfig.schema;
+
+    const auto admin = connect(sourceConfig);
+    const auto first = connect(sourceConfig);
+    const auto second = connect(sourceConfig);
+
+    auto dropTables = [&]() {
+      admin->executeNonTransaction("DROP TABLE IF EXISTS " + schema + "." + TOKEN_TABLE + "," +
+                                   schema + "." + AUTH_TABLE + "," + schema + "." +
+                                   CHANGELOG_TABLE + ";");
+    };
+    dropTables();
+    admin->executeNonTransaction(
+        "CREATE TABLE " + schema + "." + TOKEN_TABLE +
+        " (service text NOT NULL, token text NOT NULL, value text NOT NULL);"
+        "CREATE TABLE " +
+        schema + "." + AUTH_TABLE +
+        " (apikey text NOT NULL, service text NOT NULL, token text NOT NULL);"
+        "CREATE TABLE " +
+        schema + "." + CHANGELOG_TABLE +
+        " (seq bigserial PRIMARY KEY, operation text, table_name text, apikey text, "
+        "service text, token text, value text);"
+        "INSERT INTO " +
+        schema + "." + AUTH_TABLE + " VALUES ('key','service','token');");
+
+    bool reloaded = false;
+    PostgresSource source(sourceConfig);
+    update(source, reloaded);
+    check(reloaded, "first round reads the tables");
+
+    // A transaction holding a lower sequence number commits after a higher one
+    {
+      auto slow = first->transaction();
+      insertToken(*slow, schema, "slow");
+      auto fast = second->transaction();
+      insertToken(*fast, schema, "fast");
+      fast->commit();
+
+      auto values = update(source, reloaded);
+      check(!reloaded && values == std::set<std::string>{"fast"}, "committed change is applied");
+      values = update(source, reloaded);
+      check(!reloaded && values.empty(), "change is applied only once");
+
+      slow->commit();
+      values = update(source, reloaded);
+      check(!reloaded && values == std::set<std::string>{"slow"},
+            "change committed out of order is applied");
+      values = update(source, reloaded);
+      check(!reloaded && values.empty(), "late change is applied only once");
+    }
+
+    // A full reload while a transaction is still running
+    {
+      auto slow = first->transaction();
+      insertToken(*slow, schema, "during reload");
+      auto fast = second->transaction();
+      insertToken(*fast, schema, "before reload");
+      fast->commit();
+
+      PostgresSource restarted(sourceConfig);
+      update(restarted, reloaded);
+      check(reloaded, "restarted source reads the tables");
+
+      slow->commit();
+      const auto values = update(restarted, reloaded);
+      check(!reloaded && values == std::set<std::string>{"during reload"},
+            "change committed after a full reload is applied");
+
+      // The first source sees both changes at once
+      update(source, reloaded);
+    }
+
+    // Rolled back transactions leave unused sequence numbers, which are skipped without
+    // reloading the tables
+    {
+      {
+        auto rolledBack = first->transaction();
+        insertToken(*rolledBack, schema, "rolled back");
+      }
+      auto committed = second->transaction();
+      insertToken(*committed, schema, "after rollback");
+      committed->commit();
+
+      auto values = update(source, reloaded);
+      check(!reloaded && values == std::set<std::string>{"after rollback"},
+            "change after a rollback is applied");
+      for (int i = 0; i < 3; i++)
+      {
+        values = update(source, reloaded);
+        check(!reloaded && values.empty(), "rolled back change is never applied");
+      }
+    }
+
+    // Without a changelog the tables are probed for changes, also for values swapped between
+    // rows which keep the row counts and the sets of values unchanged
+    {
+      auto probed = sourceConfig;
+      probed.changelogTable.clear();
+      probed.changeDetection = true;
+      PostgresSource probe(probed);
+      const auto table = schema + "." + TOKEN_TABLE;
+      admin->executeNonTransaction("INSERT INTO " + table +
+                                   " VALUES ('service','first','a'),('service','second','b');");
+
+      const auto before = version(probe);
+      check(!before.empty(), "tables are probed");
+      check(version(probe) == before, "unchanged tables have the same version");
+
+      admin->executeNonTransaction("UPDATE " + table +
+                                   " SET value = CASE value WHEN 'a' THEN 'b' ELSE 'a' END "
+                                   "WHERE token IN ('first','second');");
+      check(version(probe) != before, "values swapped between rows change the version");
+    }
+
+    dropTables();
+  }
+  catch (...)
+  {
+    Fmi::Exception::Trace(BCP, "Database tests failed").printError();
+    check(false, "database tests");
+  }
+
+  if (failures > 0)
+  {
+    std::cout << "PostgresSourceTest FAILED\n";
+    return 1;
+  }
+  std::cout << "PostgresSourceTest passed\n";
+  return 0;
+}
@@ -0,0 +1,159 @@
+// Tests of the request quotas: running out of the burst, the refill rate, totals across shards
+// from several threads, and buckets carried over when the limits change. No database needed.
+//
+// Usage: QuotaTableTest
+
+#include "QuotaTable.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, const std::string& name)
+{
+  if (!ok)
+  {
+    std::cout << "FAILED: " << name << '\n';
+    failures++;
+  }
+}
+
+// A rate so low that nothing is refilled while the test runs
+const double NO_REFILL = 1e-6;
+
+std::unique_ptr<const QuotaTable> makeTable(double rate,
+                                            double burst,
+                                            const QuotaTable* previous = nullptr)
+{
+  QuotaData quotas;
+  quotas[std::make_pair("service", "key")] = QuotaLimit{rate, burst};
+  quotas[std::make_pair("service", "other")] = QuotaLimit{NO_REFILL, 1};
+  return std::make_unique<const QuotaTable>(std::move(quotas), previous);
+}
+
+// Number of requests granted out of the given number of attempts
+int consume(const QuotaTable& table, int attempts, const std::string& apikey = "key")
+{
+  int granted = 0;
+  for (int i = 0; i < attempts; i++)
+    if (table.consume("service", apikey))
+      granted++;
+  return granted;
+}
+
+}  // namespace
+
+int main()
+{
+  // Running out of the burst, also bursts not divisible by the number of shards
+  for (const double burst : {1.0, 5.0, 8.0, 13.0, 100.0})
+  {
+    const auto table = makeTable(NO_REFILL, burst);
+    check(consume(*table, 200) == static_cast<int>(burst),
+          "burst of " + std::to_string(burst) + " is granted exactly");
+    check(!table->consume("service", "key"), "exhausted quota refuses requests");
+  }
+
+  // Quotas are independent, and requests without a quota are not limited
+  {
+    const auto table = makeTable(NO_REFILL, 3);
+    check(consume(*table, 10) == 3, "burst of one apikey");
+    check(consume(*table, 10, "other") == 1, "burst of another apikey");
+    check(consume(*table, 1000, "unlimited") == 1000, "apikey without a quota is not limited");
+    check(table->consume("other service", "key"), "service without a quota is not limited");
+  }
+
+  // A zero rate or burst refuses every request
+  for (const auto& limit : {QuotaLimit{0, 10}, QuotaLimit{10, 0}, QuotaLimit{0, 0}})
+  {
+    const auto table = makeTable(limit.rate, limit.burst);
+    check(consume(*table, 100) == 0,
+          "rate " + std::to_string(limit.rate) + " and burst " + std::to_string(limit.burst) +
+              " refuse every request");
+  }
+
+  // The refill rate: a burst of 2 and 20 requests per second for half a second
+  {
+    const auto table = makeTable(20, 2);
+    const auto start = std::chrono::steady_clock::now();
+    int granted = 0;
+    while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500))
+    {
+      granted += consume(*table, 1);
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    check(granted >= 2 + 8 && granted <= 2 + 11,
+          "refill at the rate of the quota (" + std::to_string(granted) + " granted)");
+  }
+
+  // An idle bucket refills only up to the burst
+  {
+    const auto table = makeTable(1000, 4);
+    consume(*table, 10);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    check(consume(*table, 100) == 4, "idle bucket saves up no more than the burst");
+  }
+
+  // Totals across shards from several threads
+  {
+    const int burst = 1000;
+    const auto table = makeTable(NO_REFILL, burst);
+    std::atomic<int> granted{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 12; t++)
+      threads.emplace_back([&]() { granted += consume(*table, 400); });
+    for (auto& thread : threads)
+      thread.join();
+    check(granted == burst,
+          "threads share the burst exactly (" + std::to_string(granted.load()) + " granted)");
+  }
+
+  // Buckets carried over from the previous table
+  {
+    const auto first = makeTable(NO_REFILL, 10);
+    consume(*first, 10);
+    const auto same = makeTable(NO_REFILL, 10, first.get());
+    check(consume(*same, 10) == 0, "unchanged limits are not refilled");
+    const auto smaller = makeTable(NO_REFILL, 4, same.get());
+    check(consume(*smaller, 10) == 0, "smaller burst is not refilled");
+    const auto otherRate = makeTable(2 * NO_REFILL, 10, smaller.get());
+    check(consume(*otherRate, 10) == 0, "other rate is not refilled");
+    const auto larger = makeTable(NO_REFILL, 25, otherRate.get());
+    check(consume(*larger, 30) == 15, "larger burst adds only the difference");
+  }
+  {
+    const auto first = makeTable(NO_REFILL, 8);
+    consume(*first, 3);
+    const auto same = makeTable(NO_REFILL, 8, first.get());
+    check(consume(*same, 10) == 5, "partly spent burst is carried over");
+
+    const auto second = makeTable(NO_REFILL, 8);
+    consume(*second, 3);
+    const auto smaller = makeTable(NO_REFILL, 3, second.get());
+    check(consume(*smaller, 10) == 0, "spent requests exceeding a smaller burst");
+    const auto larger = makeTable(NO_REFILL, 16, second.get());
+    check(consume(*larger, 20) == 13, "partly spent burst carried over to a larger burst");
+    const auto blocked = makeTable(0, 0, second.get());
+    check(consume(*blocked, 10) == 0, "zero limits after a quota");
+    const auto unblocked = makeTable(NO_REFILL, 5, blocked.get());
+    check(consume(*unblocked, 10) == 5, "quota after zero limits starts full");
+  }
+
+  if (failures > 0)
+  {
+    std::cout << "QuotaTableTest FAILED\n";
+    return 1;
+  }
+  std::cout << "QuotaTableTest passed\n";
+  return 0;
+}
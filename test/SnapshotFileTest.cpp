@@ -0,0 +1,203 @@
+// Tests of the snapshot file: round trips with and without memory mapping, and rejection of
+// corrupt and stale files. No database needed.
+//
+// Usage: SnapshotFileTest [directory for the temporary files]
+
+#include "Snapshot.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+int failures = 0;
+
+void check(bool ok, const std::string& name)
+{
+  if (!ok)
+  {
+    std::cout << "FAILED: " << name << '\n';
+    failures++;
+  }
+}
+
+// Offset of the creation time in the file header, after the magic number and the version
+const std::streamoff CREATED_OFFSET = 8;
+
+std::unique_ptr<const Snapshot> makeSnapshot()
+{
+  std::vector<std::shared_ptr<const ServiceIndex>> services;
+  for (int s = 0; s < 3; s++)
+  {
+    ServiceIndex::Builder builder("service" + std::to_string(s));
+    for (int t = 0; t < 5; t++)
+      for (int v = 0; v < 20; v++)
+        builder.addTokenValue("token" + std::to_string(t), "value" + std::to_string(t * 100 + v));
+    for (int a = 0; a < 50; a++)
+      builder.addGrant("apikey" + std::to_string(a), "token" + std::to_string((a + s) % 5));
+    builder.addGrant("admin", WILDCARD_IDENTIFIER);
+    builder.addGrant("expiring", "token0", std::time(nullptr) + 3600);
+    services.push_back(builder.build());
+  }
+  return std::make_unique<const Snapshot>(std::move(services));
+}
+
+// The access status, or -1 for an unknown service
+int verdict(const Snapshot& snapshot,
+            const std::string& service,
+            const std::string& apikey,
+            const std::string& value)
+{
+  const auto* index = snapshot.find(service);
+  if (!index)
+    return -1;
+  return static_cast<int>(index->resolveAccessById(snapshot.findApikey(*index, apikey), value));
+}
+
+// Every verdict of the loaded snapshot must equal that of the original
+bool sameVerdicts(const Snapshot& original, const Snapshot& loaded)
+{
+  if (original.services().size() != loaded.services().size())
+    return false;
+  const std::vector<std::string> apikeys{"apikey0", "apikey7", "apikey49", "admin", "expiring",
+                                         "nobody"};
+  for (int s = 0; s < 4; s++)
+    for (const auto& apikey : apikeys)
+      for (int t = 0; t < 6; t++)
+        for (int v = 0; v < 21; v++)
+        {
+          const auto service = "service" + std::to_string(s);
+          const auto value = "value" + std::to_string(t * 100 + v);
+          if (verdict(original, service, apikey, value) != verdict(loaded, service, apikey, value))
+            return false;
+        }
+  return true;
+}
+
+bool readFails(const std::string& filename, int maxAgeSeconds, bool mapped)
+{
+  try
+  {
+    Snapshot::read(filename, maxAgeSeconds, mapped);
+    return false;
+  }
+  catch (...)
+  {
+    return true;
+  }
+}
+
+void copyFile(const std::string& from, const std::string& to)
+{
+  std::ifstream in(from, std::ios::binary);
+  std::ofstream out(to, std::ios::binary | std::ios::trunc);
+  out << in.rdbuf();
+}
+
+void patchFile(const std::string& filename, std::streamoff offset, const void* data, std::size_t n)
+{
+  std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+  file.seekp(offset);
+  file.write(static_cast<const char*>(data), static_cast<std::streamsize>(n));
+}
+
+std::int64_t fileSize(const std::string& filename)
+{
+  std::ifstream in(filename, std::ios::binary | std::ios::ate);
+  return static_cast<std::int64_t>(in.tellg());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  const std::string dir = (argc > 1 ? argv[1] : "/tmp");
+  const std::string filename = dir + "/SnapshotFileTest.bin";
+  const std::string scratch = dir + "/SnapshotFileTest.tmp.bin";
+  const int maxAge = 3600;
+
+  const auto original = makeSnapshot();
+  original->write(filename);
+
+  // Round trips
+  for (bool mapped : {false, true})
+  {
+    const std::string mode = (mapped ? " (mmap)" : "");
+    try
+    {
+      const auto loaded = Snapshot::read(filename, maxAge, mapped);
+      check(sameVerdicts(*original, *loaded), "identical verdicts after a round trip" + mode);
+      check(loaded->statistics().apikeys == original->statistics().apikeys,
+            "identical statistics after a round trip" + mode);
+    }
+    catch (...)
+    {
+      check(false, "reading a valid file" + mode);
+    }
+  }
+
+  // A single flipped byte anywhere after the header
+  const auto size = fileSize(filename);
+  for (std::int64_t offset : {std::int64_t(40), size / 2, size - 1})
+  {
+    copyFile(filename, scratch);
+    char byte = 0;
+    {
+      std::ifstream in(scratch, std::ios::binary);
+      in.seekg(offset);
+      in.get(byte);
+    }
+    byte = static_cast<char>(byte ^ 0x01);
+    patchFile(scratch, offset, &byte, 1);
+    for (bool mapped : {false, true})
+      check(readFails(scratch, maxAge, mapped),
+            "corrupt byte at offset " + std::to_string(offset) + " is rejected");
+  }
+
+  // Truncated file
+  {
+    std::ofstream out(scratch, std::ios::binary | std::ios::trunc);
+    out << "SNAP";
+  }
+  check(readFails(scratch, maxAge, false), "truncated file is rejected");
+
+  // A file older than the maximum age
+  copyFile(filename, scratch);
+  std::remove((scratch + ".checked").c_str());
+  const std::int64_t old = std::time(nullptr) - maxAge - 60;
+  patchFile(scratch, CREATED_OFFSET, &old, sizeof(old));
+  check(readFails(scratch, maxAge, false), "stale file is rejected");
+  check(readFails(scratch, maxAge, true), "stale file is rejected (mmap)");
+  check(!readFails(scratch, 2 * maxAge, false), "old file within a longer maximum age is read");
+
+  // A recent check of unchanged data keeps the file fresh, but only for the same contents
+  Snapshot::markChecked(scratch);
+  check(!readFails(scratch, maxAge, false), "recently checked file is read");
+  const auto checkedFile = scratch + ".checked";
+  {
+    // A check recorded for some other contents of the file
+    std::ofstream out(checkedFile, std::ios::trunc);
+    out << 12345 << ' ' << std::time(nullptr) << '\n';
+  }
+  check(readFails(scratch, maxAge, false), "check of other contents is ignored");
+
+  std::remove(filename.c_str());
+  std::remove(scratch.c_str());
+  std::remove(checkedFile.c_str());
+
+  if (failures > 0)
+  {
+    std::cout << "SnapshotFileTest FAILED\n";
+    return 1;
+  }
+  std::cout << "SnapshotFileTest passed\n";
+  return 0;
+}
@@ -0,0 +1,220 @@
+// Stress test of lookups while new snapshots are swapped in continuously. No database needed.
+//
+// Usage: SnapshotSwapTest [threads] [seconds] [apikeys per service]
+//
+// Reader threads resolve queries through SnapshotPointer exactly as the engine does, while
+// the writer publishes a new snapshot in a tight loop. Snapshot number n grants apikey a
+// token (a + n) % TOKENS only, hence the verdicts of all the tokens of a query tell which
+// snapshot answered it. As with copy-on-write updates, each new snapshot shares most of its
+// services with prebuilt ones and has one service built from scratch. Every answer must come
+// from a single snapshot published during the call. Reports the latency percentiles of the
+// lookups, the maximum stall of lookups overlapping a swap, and the duration of the swaps.
+// Build with -fsanitize=thread to check for data races, see the tsan target of the Makefile.
+
+#include "Snapshot.h"
+#include "SnapshotPointer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace SmartMet::Engine::Authentication;
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+const int SERVICES = 20;
+const int TOKENS = 16;
+const int VALUES = 50;
+
+std::int64_t nanoseconds(Clock::duration duration)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+}
+
+std::string valueName(int token, int value)
+{
+  return "value" + std::to_string(token) + "_" + std::to_string(value);
+}
+
+// Service s of snapshot number n
+std::shared_ptr<const ServiceIndex> makeService(int s, int n, int apikeys)
+{
+  ServiceIndex::Builder builder("service" + std::to_string(s));
+  for (int t = 0; t < TOKENS; t++)
+    for (int v = 0; v < VALUES; v++)
+      builder.addTokenValue("token" + std::to_string(t), valueName(t, v));
+  for (int a = 0; a < apikeys; a++)
+    builder.addGrant("apikey" + std::to_string(a), "token" + std::to_string((a + n) % TOKENS));
+  return builder.build();
+}
+
+// Snapshot number n, built from the prebuilt services of snapshot n % TOKENS apart from
+// service n % SERVICES
+using Services = std::vector<std::shared_ptr<const ServiceIndex>>;
+
+std::unique_ptr<const Snapshot> makeSnapshot(int n,
+                                             int apikeys,
+                                             const std::vector<Services>& variants)
+{
+  auto services = variants[n % TOKENS];
+  services[n % SERVICES] = makeService(n % SERVICES, n, apikeys);
+  return std::make_unique<const Snapshot>(std::move(services));
+}
+
+struct ReaderResult
+{
+  std::vector<std::int64_t> samples;  // every 16th latency
+  std::int64_t maxLatency = 0;
+  std::int64_t maxSwapLatency = 0;  // of lookups overlapping a swap
+  std::size_t lookups = 0;
+  std::size_t inconsistent = 0;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[])
+{
+  const int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+  const int threadCount = (argc > 1 ? std::atoi(argv[1]) : 2 * cores);
+  const int seconds = (argc > 2 ? std::atoi(argv[2]) : 5);
+  const int apikeys = (argc > 3 ? std::atoi(argv[3]) : 10000);
+
+  SnapshotPointer<Snapshot> pointer;
+
+  // Number of the latest snapshot whose publication has started, and of the latest one
+  // whose publication has completed
+  std::atomic<int> announced{0};
+  std::atomic<int> published{0};
+  std::atomic<int> swapping{0};
+  std::atomic<bool> done{false};
+
+  std::vector<Services> variants(TOKENS);
+  for (int n = 0; n < TOKENS; n++)
+    for (int s = 0; s < SERVICES; s++)
+      variants[n].push_back(makeService(s, n, apikeys));
+
+  pointer.publish(makeSnapshot(0, apikeys, variants));
+
+  std::vector<ReaderResult> results(threadCount);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < threadCount; t++)
+    readers.emplace_back([&, t]() {
+      auto& result = results[t];
+      std::mt19937 rng(static_cast<unsigned>(t + 1));
+      std::vector<std::string> apikeyNames;
+      for (int a = 0; a < apikeys; a++)
+        apikeyNames.push_back("apikey" + std::to_string(a));
+      std::vector<std::string> serviceNames;
+      for (int s = 0; s < SERVICES; s++)
+        serviceNames.push_back("service" + std::to_string(s));
+      std::vector<std::vector<std::string>> values(VALUES);
+      for (int v = 0; v < VALUES; v++)
+        for (int token = 0; token < TOKENS; token++)
+          values[v].push_back(valueName(token, v));
+
+      bool verdicts[TOKENS];
+      while (!done.load(std::memory_order_relaxed))
+      {
+        const int a = static_cast<int>(rng() % apikeys);
+        const auto& service = serviceNames[rng() % SERVICES];
+        const auto& queryValues = values[rng() % VALUES];
+
+        const int first = published.load();
+        const bool overlapsSwap = (swapping.load() != 0);
+        const auto start = Clock::now();
+        {
+          const auto snapshot = pointer.read();
+          const auto* index = snapshot->find(service);
+          const auto apikeyId = (index ? snapshot->findApikey(*index, apikeyNames[a]) : 0);
+          for (int token = 0; token < TOKENS; token++)
+            verdicts[token] =
+                (index && index->resolveAccessById(apikeyId, queryValues[token]) ==
+                              AccessStatus::GRANT);
+        }
+        const auto latency = nanoseconds(Clock::now() - start);
+        const int last = announced.load();
+
+        if (result.lookups++ % 16 == 0)
+          result.samples.push_back(latency);
+        result.maxLatency = std::max(result.maxLatency, latency);
+        if (overlapsSwap || swapping.load() != 0)
+          result.maxSwapLatency = std::max(result.maxSwapLatency, latency);
+
+        // Exactly one token must be granted, and it identifies the snapshot modulo TOKENS
+        const auto granted = std::count(verdicts, verdicts + TOKENS, true);
+        const auto token = std::find(verdicts, verdicts + TOKENS, true) - verdicts;
+        bool ok = (granted == 1);
+        if (ok && last - first < TOKENS)
+        {
+          ok = false;
+          for (int n = first; n <= last; n++)
+            ok |= ((a + n) % TOKENS == token);
+        }
+        if (!ok)
+          result.inconsistent++;
+      }
+    });
+
+  // The writer publishes new snapshots in a tight loop
+  std::vector<std::int64_t> swapTimes;
+  const auto end = Clock::now() + std::chrono::seconds(seconds);
+  for (int n = 1; Clock::now() < end; n++)
+  {
+    auto snapshot = makeSnapshot(n, apikeys, variants);
+    announced = n;
+    swapping++;
+    const auto start = Clock::now();
+    pointer.publish(std::move(snapshot));
+    swapTimes.push_back(nanoseconds(Clock::now() - start));
+    swapping--;
+    published = n;
+  }
+  done = true;
+  for (auto& reader : readers)
+    reader.join();
+
+  ReaderResult total;
+  for (const auto& result : results)
+  {
+    total.samples.insert(total.samples.end(), result.samples.begin(), result.samples.end());
+    total.maxLatency = std::max(total.maxLatency, result.maxLatency);
+    total.maxSwapLatency = std::max(total.maxSwapLatency, result.maxSwapLatency);
+    total.lookups += result.lookups;
+    total.inconsistent += result.inconsistent;
+  }
+
+  auto percentile = [](std::vector<std::int64_t>& samples, double p) -> std::int64_t {
+    if (samples.empty())
+      return 0;
+    const auto i = std::min(samples.size() - 1, static_cast<std::size_t>(p * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + i, samples.end());
+    return samples[i];
+  };
+
+  std::cout << "threads=" << threadCount << " swaps=" << swapTimes.size()
+            << " lookups=" << total.lookups << '\n'
+            << "lookup_ns p50=" << percentile(total.samples, 0.5)
+            << " p99=" << percentile(total.samples, 0.99)
+            << " p999=" << percentile(total.samples, 0.999) << " max=" << total.maxLatency
+            << " max_during_swap=" << total.maxSwapLatency << '\n'
+            << "swap_ns p50=" << percentile(swapTimes, 0.5)
+            << " max=" << percentile(swapTimes, 1.0) << '\n'
+            << "inconsistent=" << total.inconsistent << '\n';
+
+  if (total.inconsistent > 0 || swapTimes.empty())
+  {
+    std::cout << "SnapshotSwapTest FAILED\n";
+    return 1;
+  }
+  std::cout << "SnapshotSwapTest passed\n";
+  return 0;
+}